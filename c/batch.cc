@@ -0,0 +1,140 @@
+// batch.cc
+//
+// Batch mode, 'crustcool --batch <manifest> [-j nthreads] [name]'
+//
+// Each line of the manifest is one model, given as parameter names and values
+// that override the ones in init.dat, e.g.
+//
+//     Tc 3e7 Qimp 2.0
+//     Tc 4e7 Qimp 1.0 mass 1.8
+//
+// The models are run on a work-stealing thread pool, so that a few slow models
+// (stiff heating, long timetorun, ...) don't hold up the rest. Each worker keeps
+// a Run that stays set up between models. Whenever its setup parameters are the
+// same as the base model's it uses the base CrustModel (grid, tables and envelope)
+// rather than being set up; a model that changes e.g. the mass is set up again by
+// its worker.
+//
+// A line "<manifest line number> <chisq> <seconds>" is written to stdout as each
+// model finishes, so they come out in the order they finish, not the order of
+// the manifest. A model with an unknown parameter, or one that fails (e.g. an
+// envelope that can't be calculated), gives "<line> error <message>" instead,
+// and the rest carry on. The rest of the output goes to stderr.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include "../h/batch.h"
+#include "../h/pool.h"
+#include "../h/timer.h"
+#include "../h/fail.h"
+
+
+void run_batch(Run &base, const char *manifest, int nthreads)
+{
+	FILE *fp = fopen(manifest,"r");
+	if (fp == NULL) {
+		printf("Could not open manifest %s\n", manifest);
+		exit(1);
+	}
+	std::vector<std::string> jobs;
+	std::vector<int> lines;
+	char s[1000];
+	int line=0;
+	while (fgets(s,1000,fp) != NULL) {
+		line++;
+		char key[200];
+		if (sscanf(s,"%199s",key) != 1 || key[0] == '#') continue;
+		jobs.push_back(s);
+		lines.push_back(line);
+	}
+	fclose(fp);
+
+	// results go to stdout, so move everything else to stderr
+	fflush(stdout);
+	FILE *out = fdopen(dup(1),"w");
+	dup2(2,1);
+
+	// the workers share the base model's grid and tables
+	// (no output files, since the models run at the same time)
+	base.output_heating=0;
+	base.output_cooling=0;
+	base.crust.output=0;
+	base.setup();
+
+	printf("Running %d models on %d threads\n", (int) jobs.size(), nthreads);
+	double start=wall_time();
+
+	std::vector<Run *> workers(nthreads,(Run *) NULL);
+	std::mutex out_lock;
+	{
+		ThreadPool pool(nthreads);
+		for (int k=0; k<(int) jobs.size(); k++) {
+			pool.submit([&,k](int w) {
+				// each worker's Run is set up on its first model
+				if (workers[w] == NULL) workers[w] = new Run;
+				Run *run = workers[w];
+
+				run->copy_parameters(base);
+				char text[1000], error[300]="", *save;
+				strcpy(text,jobs[k].c_str());
+				char *key = strtok_r(text," \t\n",&save);
+				while (key != NULL) {
+					char *value = strtok_r(NULL," \t\n",&save);
+					int found=0;
+					if (value == NULL) found=0;
+					else if (!strncmp(key,"source",6) || !strncmp(key,"envlib",6))
+						found = run->set_string_parameter(key,value);
+					else
+						found = run->set_parameter(key,atof(value));
+					if (!found) {
+						sprintf(error,"unknown parameter %s",key);
+						break;
+					}
+					key = strtok_r(NULL," \t\n",&save);
+				}
+				if (error[0] != '\0') {
+					std::unique_lock<std::mutex> g(out_lock);
+					fprintf(out,"%d error %s\n",lines[k],error);
+					fflush(out);
+					return;
+				}
+
+				run->output_heating=0;
+				run->output_cooling=0;
+				run->crust.output=0;
+				// a model that fails only loses its own line
+				double t0=wall_time(), chisq=0.0;
+				fail_by_throwing(1);
+				try {
+					if (run->needs_setup) {
+						if (run->same_setup(base)) run->setup_from(base);
+						else run->setup();
+					}
+					chisq = run->run();
+				} catch (Failure &e) {
+					fail_by_throwing(0);
+					run->invalidate(STAGE_SETUP);
+					std::unique_lock<std::mutex> g(out_lock);
+					fprintf(out,"%d error %s\n",lines[k],e.message);
+					fflush(out);
+					return;
+				}
+				fail_by_throwing(0);
+				double t1=wall_time();
+
+				std::unique_lock<std::mutex> g(out_lock);
+				fprintf(out,"%d %.10g %lg\n",lines[k],chisq,t1-t0);
+				fflush(out);
+			});
+		}
+		pool.wait();
+	}
+
+	printf("Finished %d models in %lg s\n", (int) jobs.size(), wall_time()-start);
+	for (int w=0; w<nthreads; w++) delete workers[w];
+	fclose(out);
+}
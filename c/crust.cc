@@ -7,6 +7,15 @@
 #include "../h/vector.h"
 #include "../h/crust.h"
 #include "../h/timer.h"
+#include "../h/envlib.h"
+#include "../h/envelope.h"
+#include "../h/fail.h"
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <mutex>
 
 // --------------------------------- Constructor and destructor ---------------------------------------------
 
@@ -35,6 +44,10 @@ Crust::Crust() {
 	// Envelope model
 	this->gpe=0;	
 	this->use_my_envelope=0;
+	this->ylight=-1.0;    // if not set, use gpe to choose between the He4 and He9 envelopes
+	strcpy(this->envelope_library,"envelope_data/library");
+	this->envelope_g=2.28e14;
+	this->flux_table=NULL;
 	
 	// Other parameters that are used during time evolution
 	this->Qimp=1.0;
@@ -67,13 +80,28 @@ Crust::Crust() {
 	this->use_potek_eos=0;
 	
 	this->resume = 0;    // if =1 then read in the temperature profile from last time and start from there
+
+	// storage is allocated in setup
+	this->grid=NULL;
+	this->pins=0;
+	this->EOS=NULL;
+	this->model=NULL;
+	this->CP_grid=NULL;
+	this->tables_ready=0;
+	this->shared_tables=0;
+	this->table_nbeta=100;
+	this->ode_eps=1e-7;
 }
 
 
 Crust::~Crust() {
 	// destructor
 	this->ODE.tidy(); 
+	free_tables();
 	delete [] this->grid;
+	for (int k=0; k<(int) this->retired_grids.size(); k++) delete [] this->retired_grids[k];
+	if (this->model != NULL) this->model->release();
+	delete this->EOS;
 }
 
 // --------------------------------- Setup ---------------------------------------------
@@ -83,11 +111,7 @@ void Crust::setup(void) {
 	printf("Setting up...\n");
 
 	if (this->yt < 10.0) this->yt=pow(10.0,this->yt);
-	if (this->extra_y < 16.0) this->extra_y=pow(10.0,this->extra_y);
 
-	if (this->Qinner == -1.0) this->Qinner=this->Qimp;
-	if (this->energy_deposited_inner == -1.0) this->energy_deposited_inner = this->energy_deposited_outer;
-	
 	if (this->Qimp>=0.0) {   	// the Q values are assigned directly in 'calculate_vars'
 		this->hardwireQ=1;
 		printf("Using supplied Qimp values and HZ composition and heating.\n");
@@ -96,26 +120,115 @@ void Crust::setup(void) {
 		printf("Using Qimp, composition, and heating from the crust model.\n");
 	}
 
-	if (this->angle_mu >= 0.0) this->B*=sqrt(0.75*this->angle_mu*this->angle_mu+0.25);
-	printf("Magnetic field set to B=%lg\n", this->B);
+	// the field is scaled for the EOS only, so that setup can be called again
+	double Beff=this->B;
+	if (this->angle_mu >= 0.0) Beff*=sqrt(0.75*this->angle_mu*this->angle_mu+0.25);
+	printf("Magnetic field set to B=%lg\n", Beff);
 
-	static Eos myeos(1);
-	this->EOS = &myeos;
+	// each crust has its own EOS so that several can be evolved at once
+	if (this->EOS == NULL) this->EOS = new Eos(1);
 	this->EOS->Qimp=this->Qimp;
 	this->EOS->gap=this->gap;
 	this->EOS->kncrit=this->kncrit;
-	this->EOS->B=this->B;
+	this->EOS->B=Beff;
 	this->EOS->accr=this->accr;
 	this->EOS->use_potek_eos=this->use_potek_eos;
 	
 	set_ns_parameters(this->mass,this->radius,&this->g,&this->ZZ);
 	set_up_grid("data/crust_model_shell");
 	get_TbTeff_relation();
-	
+	make_surface_flux_table();
+
+	// keep the results in a new model, which other crusts can then use too
+	CrustModel *m = new CrustModel(this->N);
+	m->hardwireQ=this->hardwireQ;
+	m->Pb=this->Pb; m->Pt=this->Pt; m->yt=this->yt; m->dx=this->dx;
+	m->g=this->g; m->ZZ=this->ZZ; m->mass=this->mass; m->radius=this->radius;
+	for (int i=0; i<=this->N+1; i++) m->grid[i]=this->grid[i];
+	m->B=this->EOS->B; m->kncrit=this->kncrit;
+	m->gap=this->gap; m->accr=this->accr; m->use_potek_eos=this->use_potek_eos;
+	m->nflux=this->nflux; m->lgTflux_min=this->lgTflux_min; m->dlgTflux=this->dlgTflux;
+	m->flux_table=this->flux_table;
+	use_model(m);
+	m->release();
+}
+
+
+void Crust::use_model(CrustModel *m)
+// Uses a model made by setup, possibly by another crust. This takes the place of
+// setup, and only sets up the state for the time evolution, so it is fast.
+// The parameters that the model depends on must be the same as for the crust
+// that made it (see Run::same_setup); the rest can be different.
+{
+	m->retain();
+	free_tables();
+	if (this->model != NULL) this->model->release();
+	this->model=m;
+
+	this->N=m->N;
+	this->hardwireQ=m->hardwireQ;
+	this->Pb=m->Pb; this->Pt=m->Pt; this->yt=m->yt; this->dx=m->dx;
+	this->g=m->g; this->ZZ=m->ZZ; this->mass=m->mass; this->radius=m->radius;
+	if (this->grid != m->grid) {
+		new_grid();
+		for (int i=0; i<=this->N+1; i++) this->grid[i]=m->grid[i];
+	}
+	this->nflux=m->nflux; this->lgTflux_min=m->lgTflux_min; this->dlgTflux=m->dlgTflux;
+	this->flux_table=m->flux_table;
+
+	if (this->EOS == NULL) this->EOS = new Eos(1);
+	this->EOS->Qimp=this->Qimp;
+	this->EOS->B=m->B;
+	this->EOS->kncrit=m->kncrit;
+	this->EOS->gap=m->gap;
+	this->EOS->accr=m->accr;
+	this->EOS->use_potek_eos=m->use_potek_eos;
+
 	// initialize the integrator
   	this->ODE.init(this->N+1,dynamic_cast<Ode_Int_Delegate *>(this));
 	this->ODE.verbose=0;
   	this->ODE.stiff=1; this->ODE.tri=1;  // stiff integrator with tridiagonal solver
+
+	make_tables();
+	reset();
+}
+
+
+void Crust::new_grid(void)
+// allocates the grid for N points, keeping the old one while the grid is pinned
+{
+	if (this->pins > 0 && this->grid != NULL) this->retired_grids.push_back(this->grid);
+	else delete [] this->grid;
+	this->grid = new GridPoint [this->N+2];
+}
+
+
+void Crust::unpin(void)
+{
+	if (--this->pins > 0) return;
+	for (int k=0; k<(int) this->retired_grids.size(); k++) delete [] this->retired_grids[k];
+	this->retired_grids.clear();
+}
+
+
+void Crust::reset(void)
+// Puts the crust back into its initial state ready for a new run. The grid,
+// envelope and precalculated tables are kept, so only the parameters used during
+// the time evolution (Tc, Tt, Qimp, Qinner, mdot, heating...) may change between
+// calls. Anything else needs setup to be called again.
+{
+	if (this->extra_y < 16.0) this->extra_y=pow(10.0,this->extra_y);
+
+	this->EOS->Qimp=this->Qimp;
+	if (this->Qinner == -1.0) this->Qinner_eff=this->Qimp;
+	else this->Qinner_eff=this->Qinner;
+	if (this->energy_deposited_inner == -1.0) this->Einner_eff=this->energy_deposited_outer;
+	else this->Einner_eff=this->energy_deposited_inner;
+
+	this->timesofar=0.0;
+	this->last_time_output=0.0;
+	for (int i=0; i<=this->N+1; i++) this->grid[i].T=this->Tc;
+	if (this->resume) read_T_profile_from_file();
 }
 
 
@@ -170,7 +283,7 @@ void Crust::set_up_grid(const char *fname)
 	}
 
   	// storage
-	this->grid = new GridPoint [this->N+2];
+	new_grid();
 
 	// grid spacing (equal spacing in log column)
  	this->dx=log(this->Pb/this->Pt)/(this->N-1);
@@ -183,8 +296,11 @@ void Crust::set_up_grid(const char *fname)
     	double x=log(this->Pt)+this->dx*(i-1);
     	this->grid[i].P=exp(x);
 		this->EOS->P = this->grid[i].P;
-		  // we have to set the temperature to something
-		this->grid[i].T = this->Tc;
+		// we have to set the temperature to something; a fixed reference temperature
+		// (the default Tc) is used rather than Tc, so that the grid and the tables don't
+		// depend on Tc and can be shared between models with different Tc (the
+		// temperature only enters rho in the outermost, non-degenerate cells)
+		this->grid[i].T = 3e7;
 		this->EOS->T8=this->grid[i].T/1e8; 
 		set_composition();
 		this->EOS->rho=this->EOS->find_rho();
@@ -237,8 +353,6 @@ void Crust::set_up_grid(const char *fname)
 
 	if (!this->hardwireQ) QiSpline.tidy();
 
-	if (this->resume) read_T_profile_from_file();
-
   	printf("Grid has %d points, delx=%lg, Pb=%lg, rhob=%lg, Pt=%lg, rhot=%lg, thickness=%lg m\n", 
 			this->N, this->dx, this->grid[this->N].P,this->grid[this->N].rho,this->grid[1].P,this->grid[1].rho,(this->grid[0].r-this->grid[this->N+1].r)*1e-2);
 	if (!this->hardwireQ)
@@ -247,29 +361,44 @@ void Crust::set_up_grid(const char *fname)
 
 
 void Crust::get_TbTeff_relation(void)
+// sets up the Flux-T relation at the top of the grid, either from a precomputed
+// envelope or, if there isn't one for these parameters, by solving for it
+{
+	if (this->use_my_envelope == 2) {
+		if (get_TbTeff_relation_from_library()) return;
+	} else {
+		const char *fname=NULL;
+		if (this->use_my_envelope) {
+			if (this->EOS->B == 1e15) fname="envelope_data/grid_1e15_nopotek";
+			else if (this->EOS->B == 1e14) fname="envelope_data/grid_1e14_potek";
+			else if (this->EOS->B == 3e14) fname="envelope_data/grid_3e14_potek";
+			else if (this->EOS->B == 3e15) fname="envelope_data/grid_3e15_potek";
+		} else {
+			if (this->gpe) fname="envelope_data/grid_He4";
+			else fname="envelope_data/grid_He9";
+		}
+		if (fname != NULL && read_TbTeff_grid(fname)) return;
+	}
+
+	printf("No precomputed envelope for B=%lg, ytop=%lg\n", this->EOS->B, this->yt);
+	solve_TbTeff_relation();
+}
+
+
+int Crust::read_TbTeff_grid(const char *fname)
 // reads in the Flux-T relation from the data file output by makegrid.cc
+// returns 0 if the file is missing or doesn't contain the top column
 {
+	// the file "envelope_data/grid" is made by makegrid.cc
+	// it contains  (column depth, T, flux)  in cgs
+	FILE *fp = fopen(fname,"r");
+	if (fp == NULL) return 0;
+
 	double *temp, *flux;  // temporary storage to initialize the spline
 	int npoints = 195;  //  needs to be >= number of points read in
 	temp = new double [npoints+1];
 	flux = new double [npoints+1];
 	
-	// the file "envelope_data/grid" is made by makegrid.cc
-	// it contains  (column depth, T, flux)  in cgs
-	FILE *fp;
-	if (this->use_my_envelope) {
-		if (this->EOS->B == 1e15) fp = fopen("envelope_data/grid_1e15_nopotek","r");
-		else if (this->EOS->B == 1e14) fp = fopen("envelope_data/grid_1e14_potek","r");
-		else if (this->EOS->B == 3e14) fp = fopen("envelope_data/grid_3e14_potek","r");
-		else if (this->EOS->B == 3e15) fp = fopen("envelope_data/grid_3e15_potek","r");
-		else {
-			printf("Don't know which envelope model to use for this B!\n");
-			exit(1);
-		}
-	} else {
-		if (this->gpe) fp = fopen("envelope_data/grid_He4","r");
-		else fp = fopen("envelope_data/grid_He9","r");
-	}
 	FILE *fp2=NULL;
 	if (this->output) fp2=fopen("out/TbTeff", "w");
 	
@@ -277,7 +406,7 @@ void Crust::get_TbTeff_relation(void)
 	int count = 0;
 	while (!feof(fp)) {
 		fscanf(fp, "%lg %lg %lg %lg %lg %lg\n", &y, &T, &F,&rho,&dummy,&dummy);
-		if (fabs(y-log10(this->yt))<1e-3) {  // select out the points which correspond to the top column
+		if (fabs(y-log10(this->yt))<1e-3 && count < npoints) {  // select out the points which correspond to the top column
 			count++;
 			temp[count] = pow(10.0,T);
 			// correct for gravity here:
@@ -289,9 +418,148 @@ void Crust::get_TbTeff_relation(void)
 	fclose(fp);
 	if (this->output) fclose(fp2);
 	
-	// the following spline contains the flux as a function of temperature at column depth this->yt
-	this->TEFF.minit(temp,flux,count);
+	if (count > 1) {
+		// the following spline contains the flux as a function of temperature at column depth this->yt
+		this->TEFF.minit(temp,flux,count);
+		// the grids were calculated for g=2.28e14 and are rescaled when used
+		this->envelope_g = 2.28e14;
+	} else printf("%s does not include log10 y=%lg\n", fname, log10(this->yt));
 	
+	delete [] temp;
+	delete [] flux;
+	return count > 1;
+}
+
+
+double Crust::envelope_yi(void)
+// log10 column depth of the light element layer
+{
+	if (this->ylight >= 0.0) return this->ylight;
+	return this->gpe ? 4.0 : 9.0;
+}
+
+
+int Crust::get_TbTeff_relation_from_library(void)
+// interpolates the Flux-T relation in (yi, B, g) from the envelope library made by 'makegrid'
+// in batch mode. The library includes gravity, so the relation is not rescaled with g.
+{
+	double yi = envelope_yi();
+	// the top of the grid is at pressure Pt, which is at column Pt/g in the envelope
+	double lgy0 = log10(this->Pt/this->g);
+
+	EnvelopeLibrary lib;
+	if (!lib.read(this->envelope_library)) {
+		printf("Could not read the envelope library %s\n", this->envelope_library);
+		return 0;
+	}
+	double *lgTb = new double [lib.nF];
+	if (!lib.relation(yi,this->EOS->B,this->g,lgy0,lgTb)) {
+		printf("yi=%lg B=%lg g=%lg log10 y=%lg lies outside the envelope library\n", yi, this->EOS->B, this->g, lgy0);
+		delete [] lgTb;
+		return 0;
+	}
+
+	double *temp = new double [lib.nF+1];
+	double *flux = new double [lib.nF+1];
+	FILE *fp2=NULL;
+	if (this->output) fp2=fopen("out/TbTeff", "w");
+	int count = 0;
+	for (int iF=0; iF<lib.nF; iF++) {
+		if (isnan(lgTb[iF])) continue;    // photosphere is below the top of the grid
+		count++;
+		temp[count] = pow(10.0,lgTb[iF]);
+		flux[count] = pow(10.0,lib.lgF[iF]);
+		if (this->output) fprintf(fp2, "%d %lg %lg %lg %lg %lg\n", count,lgy0,lgTb[iF],lib.lgF[iF],temp[count],flux[count]);
+	}
+	if (this->output) fclose(fp2);
+	printf("Envelope from library: yi=%lg B=%lg g14=%lg at log10 y=%lg (%d fluxes)\n", yi, this->EOS->B, this->g/1e14, lgy0, count);
+
+	if (count > 1) {
+		this->TEFF.minit(temp,flux,count);
+		this->envelope_g = this->g;
+	}
+
+	delete [] lgTb;
+	delete [] temp;
+	delete [] flux;
+	return count > 1;
+}
+
+
+void Crust::solve_TbTeff_relation(void)
+// calculates the Flux-T relation for the top column of the grid with the envelope code,
+// for these (yi, B, g). The result is kept in envelope_data/cache so that later runs with
+// the same parameters can read it in; the file is named after the exact values, since
+// the samplers vary B and ytop continuously and nearby values must not share a file.
+{
+	double yi = envelope_yi();
+	double lgy0 = log10(this->Pt/this->g);
+
+	char fname[200];
+	snprintf(fname,sizeof(fname),"envelope_data/cache/TbTeff_yi%.17g_B%.17g_y%.17g_g%.17g",yi,this->EOS->B,lgy0,this->g);
+
+	int nF=91;
+	double *temp = new double [nF+1];
+	double *flux = new double [nF+1];
+	int count=0;
+
+	FILE *fp = fopen(fname,"r");
+	if (fp != NULL) {
+		printf("Reading envelope from %s\n", fname);
+		double T,F;
+		while (count < nF && fscanf(fp,"%lg %lg\n",&T,&F) == 2) {
+			count++;
+			temp[count]=T;
+			flux[count]=F;
+		}
+		fclose(fp);
+	} else {
+		printf("Calculating envelope for yi=%lg B=%lg g14=%lg at log10 y=%lg\n", yi, this->EOS->B, this->g/1e14, lgy0);
+		clock_t timer;
+		start_timing(&timer);
+		Envelope envelope;
+		envelope.g = this->g;
+		envelope.use_potek_eos_in_He=0;
+		envelope.use_potek_cond_in_He=0;
+		envelope.use_potek_eos_in_Fe=0;
+		envelope.use_potek_cond_in_Fe=0;
+		if (this->EOS->B > 0.0) envelope.use_potek_kff=1;
+		else envelope.use_potek_kff=0;
+		for (int i=0; i<nF; i++) {
+			double F=pow(10.0,17.0+i*0.1), lgT;
+			// (no solution, or the photosphere is below the top of the grid)
+			if (!envelope.solve(yi,this->EOS->B,F,1,&lgy0,&lgT) || isnan(lgT)) continue;
+			count++;
+			temp[count]=pow(10.0,lgT);
+			flux[count]=F;
+		}
+		stop_timing(&timer,"envelope");
+
+		// write to a temporary file first so that other runs never read a partial file
+		char tmpname[250];
+		sprintf(tmpname,"%s.%d.%p",fname,(int) getpid(),(void *) this);
+		mkdir("envelope_data/cache",0755);
+		fp = fopen(tmpname,"w");
+		if (fp != NULL) {
+			for (int i=1; i<=count; i++) fprintf(fp,"%.10lg %.10lg\n",temp[i],flux[i]);
+			fclose(fp);
+			rename(tmpname,fname);
+		}
+	}
+
+	if (this->output) {
+		FILE *fp2=fopen("out/TbTeff", "w");
+		for (int i=1; i<=count; i++) fprintf(fp2, "%d %lg %lg %lg %lg %lg\n", i,lgy0,log10(temp[i]),log10(flux[i]),temp[i],flux[i]);
+		fclose(fp2);
+	}
+
+	if (count < 2) {
+		fail("Could not calculate the envelope for these parameters!");
+	}
+
+	this->TEFF.minit(temp,flux,count);
+	this->envelope_g = this->g;
+
 	delete [] temp;
 	delete [] flux;
 }
@@ -345,12 +613,12 @@ void Crust::read_T_profile_from_file(void)
 	double dd, tt;
 
 	FILE *fp = fopen("out/out","r");
+	if (fp == NULL) fail("Could not open out/out to resume from");
 
 	// first read the header
-	fscanf(fp,"%d %lg\n",&npoints,&dd);
-	if (npoints != this->N+1) {
-		printf("Problem reading previous T profile: number of grid points is different\n");
-		exit(0);
+	if (fscanf(fp,"%d %lg\n",&npoints,&dd) != 2 || npoints != this->N+1) {
+		fclose(fp);
+		fail("Problem reading previous T profile: number of grid points is different");
 	}
 	
 	while (!feof(fp)) {	
@@ -405,7 +673,7 @@ void Crust::evolve(double timetorun, double mdot) {
 	for (int i=1; i<=this->N+1; i++) {
 		this->ODE.set_bc(i,this->grid[i].T);
 	}
-	this->ODE.go(0.0, this->outburst_duration*3.15e7, this->outburst_duration*3.15e7*0.01,1e-7);
+	this->ODE.go(0.0, this->outburst_duration*3.15e7, this->outburst_duration*3.15e7*0.01,this->ode_eps);
 	stop_timing(&timer,"this->ODE.go");
 	printf("Number of integration steps = %d\n", this->ODE.kount);
 	for (int i=1; i<=this->N+1; i++) {
@@ -474,8 +742,8 @@ void Crust::output_result_for_step(int j, FILE *fp, FILE *fp2,double timesofar,d
 		// out/prof
 		fprintf(fp2, "%lg %lg %lg %lg %lg %lg %lg %lg %lg %lg %lg\n", (timesofar+this->ODE.get_x(j))*this->ZZ, 
 			pow((this->radius/11.2),2.0)*this->grid[2].F/(this->ZZ*this->ZZ), pow((this->radius/11.2),2.0)*FF/(this->ZZ*this->ZZ),
-			this->ODE.get_y(this->N-5,j), pow((this->g/2.28e14)*TEFF.get(this->ODE.get_y(1,j))/5.67e-5,0.25)/this->ZZ, 
-			this->ODE.get_y(1,j), pow((this->g/2.28e14)*TEFF.get(this->ODE.get_y(1,j))/5.67e-5,0.25),
+			this->ODE.get_y(this->N-5,j), pow(surface_flux(this->ODE.get_y(1,j),NULL)/5.67e-5,0.25)/this->ZZ, 
+			this->ODE.get_y(1,j), pow(surface_flux(this->ODE.get_y(1,j),NULL)/5.67e-5,0.25),
 			pow((this->radius/11.2),2.0)*this->grid[this->N+1].F/(this->ZZ*this->ZZ),pow((this->radius/11.2),2.0)*this->grid[this->N].F/(this->ZZ*this->ZZ),
 			4.0*M_PI*pow(1e5*this->radius,2.0)*Lnu/(this->ZZ*this->ZZ), dt);
 			
@@ -534,19 +802,7 @@ void Crust::precalculate_vars(void)
 	// for historical reasons, this is called beta here
 	// (for long X-ray bursts where radiation pressure is significant,
 	// beta=Prad/P is a better variable to use)
-	this->nbeta=100;
-	this->betamin=6.5;
-	this->betamax=10.0;
-	this->deltabeta = (this->betamax-this->betamin)/(1.0*(this->nbeta-1));	
-
-	this->CP_grid = matrix(this->N+2,this->nbeta);	
-	this->K1_grid = matrix(this->N+2,this->nbeta);	
-	this->K0_grid = matrix(this->N+2,this->nbeta);	
-	this->KAPPA_grid = matrix(this->N+2,this->nbeta);	
-	this->K1perp_grid = matrix(this->N+2,this->nbeta);	
-	this->K0perp_grid = matrix(this->N+2,this->nbeta);	
-	this->NU_grid = matrix(this->N+2,this->nbeta);	
-	this->EPS_grid = matrix(this->N+2,this->nbeta);	
+	make_tables();
 
 	// For the crust heating, we need to convert the density limits into 
 	// pressures
@@ -557,105 +813,352 @@ void Crust::precalculate_vars(void)
 	EOS->set_composition_by_density();
 	this->heating_P2 = EOS->ptot();
 
-	FILE *fp = NULL;
-	char s[100];
-	if (EOS->B > 0.0) sprintf(s,"out/precalc_results_%lg",log10(EOS->B));
-	else sprintf(s,"out/precalc_results_0");
-	if (!this->force_precalc) fp=fopen(s,"r");
-	// if unsuccessful (or if precalc is set) we need to recalculate
-	if (fp == NULL) {
-		fp=fopen(s,"w");
-		printf("Precalculating quantities and writing to file %s...\n",s);
+	// the heating depends on the outburst, so it is recalculated every time
+	for (int i=1; i<=this->N+1; i++) {
+		double heating_rate = (i == this->N+1) ? 0.0 : crust_heating(i);   // no core heating
+		for (int j=1; j<=this->nbeta; j++) this->EPS_grid[i][j]=heating_rate;
+	}
+}
 
-		for (int i=1; i<=this->N+1; i++) {
-	
-			EOS->P=this->grid[i].P;
-			EOS->rho = this->grid[i].rho;
-			set_composition();
-			
-			fprintf(fp, "Grid point %d  P=%lg  rho=%lg  A=%lg  Z=%lg Yn=%lg:  T8,CP,K,eps_nu,eps_nuc\n",
-				i, this->grid[i].P, this->grid[i].rho, (1.0-EOS->Yn)*EOS->A[1], EOS->Z[1], EOS->Yn);
-		
-			double heating_rate = crust_heating(i);
-		
-			for (int j=1; j<=this->nbeta; j++) {		
-				double beta = this->betamin + (j-1)*(this->betamax-this->betamin)/(1.0*(this->nbeta-1));
-				EOS->T8 = 1e-8*pow(10.0,beta);
-
-				if (i == this->N+1) {
-					this->CP_grid[i][j] = this->C_core * EOS->T8;
-					this->NU_grid[i][j] = this->Lnu_core_norm * pow(EOS->T8, Lnu_core_alpha);
-					this->EPS_grid[i][j] = 0.0; // no core heating
-					this->K0_grid[i][j]=this->K0_grid[i-1][j];
-					this->K1_grid[i][j]=this->K1_grid[i-1][j];
-					this->K1perp_grid[i][j]=this->K1perp_grid[i-1][j];
-					this->K0perp_grid[i][j]=this->K0perp_grid[i-1][j];
-					
-				} else {
-					this->CP_grid[i][j]=EOS->CV();
-					this->NU_grid[i][j]=EOS->eps_nu();
-					this->EPS_grid[i][j]=heating_rate;
-
-					// we calculate the thermal conductivity for Q=0 and Q=1, and later interpolate to the
-					// current value of Q. This means we can keep the performance of table lookup even when
-					// doing MCMC trials which vary Q.
-
-					double Q_store=EOS->Qimp;  // store Q temporarily
-
-					EOS->Qimp=0.0;
-					double Kcond,Kcondperp;
-					//Kcond = EOS->K_cond(EOS->Chabrier_EF());
-					//Kcondperp=Kcond;
-					Kcond = EOS->potek_cond();
-					Kcondperp = EOS->Kperp;   
-					this->K0_grid[i][j]=EOS->rho*Kcond/this->grid[i].P;
-					this->K0perp_grid[i][j]=EOS->rho*Kcondperp/this->grid[i].P;
-
-					EOS->Qimp=1.0;
-					//Kcond = EOS->K_cond(EOS->Chabrier_EF());
-					//Kcondperp=Kcond;
-					Kcond = EOS->potek_cond();
-					Kcondperp = EOS->Kperp;
-					this->K1_grid[i][j]=EOS->rho*Kcond/this->grid[i].P;
-					this->K1perp_grid[i][j]=EOS->rho*Kcondperp/this->grid[i].P;
-
-					EOS->Qimp=Q_store;  // restore to previous value
-
-					// conductivity due to radiation
-					(void) EOS->opac();  // call to kappa sets the variable kappa_rad
-					this->KAPPA_grid[i][j] = 3.03e20*pow(EOS->T8,3)/(EOS->kappa_rad*this->grid[i].P);
-
-				}
-
-				fprintf(fp, "%lg %lg %lg %lg %lg %lg %lg %lg %lg\n", EOS->T8, this->CP_grid[i][j], 
-					this->K0_grid[i][j],this->K1_grid[i][j], this->K0perp_grid[i][j],this->K1perp_grid[i][j],
-					this->NU_grid[i][j], this->EPS_grid[i][j], this->KAPPA_grid[i][j] );
-			}	
+
+void Crust::make_tables(void)
+// The material properties only depend on the grid and the EOS settings, so they
+// are made once for each model and shared by all the crusts that use it
+{
+	if (this->tables_ready) return;
+	CrustModel *m=this->model;
+	{
+		std::unique_lock<std::mutex> g(m->lock);
+		if (!m->tables_ready) build_tables();
+	}
+	this->nbeta=m->nbeta;
+	this->betamin=m->betamin;
+	this->betamax=m->betamax;
+	this->deltabeta=m->deltabeta;
+	this->CP_grid=m->CP_grid;
+	this->K1_grid=m->K1_grid;
+	this->K0_grid=m->K0_grid;
+	this->KAPPA_grid=m->KAPPA_grid;
+	this->K1perp_grid=m->K1perp_grid;
+	this->K0perp_grid=m->K0perp_grid;
+	this->NU_grid=m->NU_grid;
+	// the heating table changes with every evolve, so each crust has its own
+	this->EPS_grid = matrix(this->N+2,this->nbeta);
+	this->ntable=this->N+2;
+	this->tables_ready=1;
+}
+
+
+void Crust::build_tables(void)
+// makes the model's tables: from the shared file or the precalc file if there is
+// one for this grid, and otherwise by calculating them
+{
+	CrustModel *m=this->model;
+	m->nbeta=this->nbeta=this->table_nbeta;
+	m->betamin=this->betamin=6.5;
+	m->betamax=this->betamax=10.0;
+	m->deltabeta=this->deltabeta=(this->betamax-this->betamin)/(1.0*(this->nbeta-1));
+
+	int lock=-1;
+	if (this->shared_tables) {
+		if (!this->force_precalc && attach_tables()) return;
+		// one process calculates the shared tables while the others wait for them
+		char s[220];
+		shared_table_path(s);
+		strcat(s,".lock");
+		lock=open(s,O_RDWR|O_CREAT,0644);
+		if (lock >= 0) flock(lock,LOCK_EX);
+		if (!this->force_precalc && attach_tables()) {
+			if (lock >= 0) close(lock);
+			return;
 		}
-		fclose(fp);
+	}
 
-	} else {
-		
-		printf("Reading precalculated quantities from file %s...\n", s);
+	this->CP_grid = m->CP_grid = matrix(this->N+2,this->nbeta);	
+	this->K1_grid = m->K1_grid = matrix(this->N+2,this->nbeta);	
+	this->K0_grid = m->K0_grid = matrix(this->N+2,this->nbeta);	
+	this->KAPPA_grid = m->KAPPA_grid = matrix(this->N+2,this->nbeta);	
+	this->K1perp_grid = m->K1perp_grid = matrix(this->N+2,this->nbeta);	
+	this->K0perp_grid = m->K0perp_grid = matrix(this->N+2,this->nbeta);	
+	this->NU_grid = m->NU_grid = matrix(this->N+2,this->nbeta);	
+	if (this->force_precalc || !read_tables()) calculate_tables();
+	m->tables_ready=1;
+
+	if (this->shared_tables && publish_tables()) {
+		// swap our copy for the shared one
+		free_matrix(m->CP_grid,this->N+2,this->nbeta);
+		free_matrix(m->K1_grid,this->N+2,this->nbeta);
+		free_matrix(m->K0_grid,this->N+2,this->nbeta);
+		free_matrix(m->KAPPA_grid,this->N+2,this->nbeta);
+		free_matrix(m->K1perp_grid,this->N+2,this->nbeta);
+		free_matrix(m->K0perp_grid,this->N+2,this->nbeta);
+		free_matrix(m->NU_grid,this->N+2,this->nbeta);
+		m->CP_grid=NULL;
+		m->tables_ready=0;
+		if (!attach_tables()) {
+			if (lock >= 0) close(lock);
+			fail("Could not map the shared tables that were just written");
+		}
+	}
+	if (lock >= 0) close(lock);   // also releases the lock
+}
+
+
+void Crust::calculate_tables(void)
+// calculates the material properties on the grid and writes them to the precalc file
+{
+	char s[100], tmpname[150];
+	precalc_filename(s);
+	// other crusts may be reading the file, so write a temporary file and rename it
+	sprintf(tmpname,"%s.%d.%p",s,(int) getpid(),(void *) this);
+	FILE *fp=fopen(tmpname,"w");
+	printf("Precalculating quantities and writing to file %s...\n",s);
+
+	for (int i=1; i<=this->N+1; i++) {
+
+		EOS->P=this->grid[i].P;
+		EOS->rho = this->grid[i].rho;
+		set_composition();
 		
-		for (int i=1; i<=this->N+1; i++) {
-			int kk; double dd;
-			fscanf(fp, "Grid point %d  P=%lg  rho=%lg  A=%lg  Z=%lg Yn=%lg:  T8,CP,K,eps_nu,eps_nuc\n",
-					&kk,&dd,&dd,&dd,&dd,&dd);
-			for (int j=1; j<=this->nbeta; j++) {		
-				fscanf(fp, "%lg %lg %lg %lg %lg %lg %lg %lg %lg\n", &EOS->T8, &this->CP_grid[i][j], 
-					&this->K0_grid[i][j],&this->K1_grid[i][j], &this->K0perp_grid[i][j],&this->K1perp_grid[i][j],
-					&this->NU_grid[i][j], &this->EPS_grid[i][j],&this->KAPPA_grid[i][j]);
-				// always calculate the crust heating..
-				this->EPS_grid[i][j]=crust_heating(i);
+		fprintf(fp, "Grid point %d  P=%lg  rho=%lg  A=%lg  Z=%lg Yn=%lg:  T8,CP,K,eps_nu,eps_nuc\n",
+			i, this->grid[i].P, this->grid[i].rho, (1.0-EOS->Yn)*EOS->A[1], EOS->Z[1], EOS->Yn);
+	
+		for (int j=1; j<=this->nbeta; j++) {		
+			double beta = this->betamin + (j-1)*(this->betamax-this->betamin)/(1.0*(this->nbeta-1));
+			EOS->T8 = 1e-8*pow(10.0,beta);
+
+			if (i == this->N+1) {
+				this->CP_grid[i][j] = this->C_core * EOS->T8;
+				this->NU_grid[i][j] = this->Lnu_core_norm * pow(EOS->T8, Lnu_core_alpha);
+				this->K0_grid[i][j]=this->K0_grid[i-1][j];
+				this->K1_grid[i][j]=this->K1_grid[i-1][j];
+				this->K1perp_grid[i][j]=this->K1perp_grid[i-1][j];
+				this->K0perp_grid[i][j]=this->K0perp_grid[i-1][j];
+				
+			} else {
+				this->CP_grid[i][j]=EOS->CV();
+				this->NU_grid[i][j]=EOS->eps_nu();
+
+				// we calculate the thermal conductivity for Q=0 and Q=1, and later interpolate to the
+				// current value of Q. This means we can keep the performance of table lookup even when
+				// doing MCMC trials which vary Q.
+
+				double Q_store=EOS->Qimp;  // store Q temporarily
+
+				EOS->Qimp=0.0;
+				double Kcond,Kcondperp;
+				//Kcond = EOS->K_cond(EOS->Chabrier_EF());
+				//Kcondperp=Kcond;
+				Kcond = EOS->potek_cond();
+				Kcondperp = EOS->Kperp;   
+				this->K0_grid[i][j]=EOS->rho*Kcond/this->grid[i].P;
+				this->K0perp_grid[i][j]=EOS->rho*Kcondperp/this->grid[i].P;
+
+				EOS->Qimp=1.0;
+				//Kcond = EOS->K_cond(EOS->Chabrier_EF());
+				//Kcondperp=Kcond;
+				Kcond = EOS->potek_cond();
+				Kcondperp = EOS->Kperp;
+				this->K1_grid[i][j]=EOS->rho*Kcond/this->grid[i].P;
+				this->K1perp_grid[i][j]=EOS->rho*Kcondperp/this->grid[i].P;
+
+				EOS->Qimp=Q_store;  // restore to previous value
+
+				// conductivity due to radiation
+				(void) EOS->opac();  // call to kappa sets the variable kappa_rad
+				this->KAPPA_grid[i][j] = 3.03e20*pow(EOS->T8,3)/(EOS->kappa_rad*this->grid[i].P);
+
 			}
+
+			fprintf(fp, "%lg %lg %lg %lg %lg %lg %lg %lg %lg\n", EOS->T8, this->CP_grid[i][j], 
+				this->K0_grid[i][j],this->K1_grid[i][j], this->K0perp_grid[i][j],this->K1perp_grid[i][j],
+				this->NU_grid[i][j], 0.0, this->KAPPA_grid[i][j] );   // the heating is calculated for each evolve
+		}	
+	}
+	fclose(fp);
+	rename(tmpname,s);
+}
+
+
+int Crust::read_tables(void)
+// reads the material properties from the precalc file if there is one for this grid;
+// returns 0 if not
+{
+	char s[100];
+	precalc_filename(s);
+	FILE *fp=fopen(s,"r");
+	if (fp == NULL) return 0;
+
+	printf("Reading precalculated quantities from file %s...\n", s);
+	for (int i=1; i<=this->N+1; i++) {
+		int kk; double P,dd;
+		if (fscanf(fp, "Grid point %d  P=%lg  rho=%lg  A=%lg  Z=%lg Yn=%lg:  T8,CP,K,eps_nu,eps_nuc\n",
+				&kk,&P,&dd,&dd,&dd,&dd) != 6 || kk != i || fabs(P/this->grid[i].P-1.0) > 1e-4) {
+			printf("Precalc file %s was made for a different grid\n", s);
+			fclose(fp);
+			return 0;
+		}
+		for (int j=1; j<=this->nbeta; j++) {		
+			fscanf(fp, "%lg %lg %lg %lg %lg %lg %lg %lg %lg\n", &dd, &this->CP_grid[i][j], 
+				&this->K0_grid[i][j],&this->K1_grid[i][j], &this->K0perp_grid[i][j],&this->K1perp_grid[i][j],
+				&this->NU_grid[i][j], &dd,&this->KAPPA_grid[i][j]);
 		}
-		fclose(fp);
-			
 	}
-	
+	fclose(fp);
+	return 1;
+}
+
+
+void Crust::precalc_filename(char *s)
+// the file is named after the hash of the grid and settings (table_key), so that
+// models with different grids (e.g. the samplers' cheap model) don't overwrite
+// each other's tables
+{
+	if (EOS->B > 0.0) sprintf(s,"out/precalc_results_%lg_%016llx",log10(EOS->B),table_key());
+	else sprintf(s,"out/precalc_results_0_%016llx",table_key());
+}
+
+
+void Crust::free_tables(void)
+// the model owns the tables, so only the heating table is ours
+{
+	if (!this->tables_ready) return;
+	free_matrix(this->EPS_grid,this->ntable,this->nbeta);
+	this->CP_grid=NULL;
+	this->tables_ready=0;
+}
+
+
+// With shared_tables=1 the tables are kept in a file in /dev/shm (or in out/ if
+// there is no /dev/shm), named after a hash of everything that they depend on, and
+// mapped read-only. All the processes that use the same grid and EOS settings,
+// e.g. the workers in mcee.py, then share a single copy in memory and in the cache,
+// and only the first one to need the tables calculates them. Each crust keeps its
+// own heating table. The files are not removed, so later runs use them too.
+
+struct SharedTableHeader {
+	char magic[8];
+	unsigned long long key;
+	int N, nbeta;
+	double betamin, betamax;
+	char pad[24];     // so that the tables start on a cache line
+};
+
+static const int nshared_tables=7;
+
+static unsigned long long hash_bytes(unsigned long long h, const void *p, size_t n)
+// FNV-1a
+{
+	const unsigned char *c = (const unsigned char *) p;
+	for (size_t k=0; k<n; k++) {
+		h ^= c[k];
+		h *= 1099511628211ULL;
+	}
+	return h;
 }
 
+unsigned long long Crust::table_key(void)
+// a hash of the grid and the settings that the tables depend on
+{
+	double v[] = { (double) this->N, (double) this->nbeta, this->betamin, this->betamax, EOS->B,
+		(double) this->gap, this->kncrit, (double) this->use_potek_eos, (double) this->accr,
+		(double) this->hardwireQ, this->C_core, this->Lnu_core_norm, this->Lnu_core_alpha };
+	unsigned long long h=hash_bytes(14695981039346656037ULL,v,sizeof(v));
+	for (int i=1; i<=this->N+1; i++) {
+		h=hash_bytes(h,&this->grid[i].P,sizeof(double));
+		h=hash_bytes(h,&this->grid[i].rho,sizeof(double));
+	}
+	return h;
+}
+
+void Crust::shared_table_path(char *s)
+{
+	const char *dir = (access("/dev/shm",W_OK) == 0) ? "/dev/shm" : "out";
+	sprintf(s,"%s/crustcool_tables_%016llx",dir,table_key());
+}
+
+int Crust::attach_tables(void)
+// maps the shared tables for this grid into the model if they have been
+// published; returns 0 if not
+{
+	char s[200];
+	shared_table_path(s);
+	int fd=open(s,O_RDONLY);
+	if (fd < 0) return 0;
+
+	int nrow=this->N+2, rowlen=this->nbeta+1;
+	size_t size = sizeof(SharedTableHeader) + (size_t) nshared_tables*nrow*rowlen*sizeof(double);
+	struct stat st;
+	if (fstat(fd,&st) != 0 || (size_t) st.st_size != size) {
+		close(fd);
+		return 0;
+	}
+	void *map = mmap(NULL,size,PROT_READ,MAP_SHARED,fd,0);
+	close(fd);
+	if (map == MAP_FAILED) return 0;
+	SharedTableHeader *head = (SharedTableHeader *) map;
+	if (strcmp(head->magic,"crustcl") || head->key != table_key() || head->N != this->N
+			|| head->nbeta != this->nbeta) {
+		munmap(map,size);
+		return 0;
+	}
+
+	// row pointers into the mapped tables, so that they are indexed like the others
+	CrustModel *m=this->model;
+	double *data = (double *) ((char *) map + sizeof(SharedTableHeader));
+	m->table_rows = new double* [nshared_tables*nrow];
+	for (int k=0; k<nshared_tables*nrow; k++) m->table_rows[k] = data + (size_t) k*rowlen;
+	double ***tables[] = { &m->CP_grid, &m->K1_grid, &m->K0_grid, &m->KAPPA_grid,
+		&m->K1perp_grid, &m->K0perp_grid, &m->NU_grid };
+	for (int t=0; t<nshared_tables; t++) *tables[t] = &m->table_rows[t*nrow];
+	m->table_map=map;
+	m->table_map_size=size;
+	m->tables_ready=1;
+	printf("Using the shared tables in %s\n", s);
+	return 1;
+}
+
+int Crust::publish_tables(void)
+// writes the tables to the shared file; as for the precalc file, this goes
+// through a temporary file because other processes may be mapping it
+{
+	char s[200], tmpname[250];
+	shared_table_path(s);
+	sprintf(tmpname,"%s.%d.%p",s,(int) getpid(),(void *) this);
+	FILE *fp=fopen(tmpname,"w");
+	if (fp == NULL) return 0;
+
+	SharedTableHeader head;
+	memset(&head,0,sizeof(head));
+	strcpy(head.magic,"crustcl");
+	head.key=table_key();
+	head.N=this->N;
+	head.nbeta=this->nbeta;
+	head.betamin=this->betamin;
+	head.betamax=this->betamax;
+	fwrite(&head,sizeof(head),1,fp);
+
+	// rows are laid out as in matrix(), counting from 1
+	double **tables[] = { this->CP_grid, this->K1_grid, this->K0_grid, this->KAPPA_grid,
+		this->K1perp_grid, this->K0perp_grid, this->NU_grid };
+	double *row = new double [this->nbeta+1];
+	for (int t=0; t<nshared_tables; t++) {
+		for (int i=0; i<=this->N+1; i++) {
+			for (int j=0; j<=this->nbeta; j++) row[j]=0.0;
+			if (i >= 1) for (int j=1; j<=this->nbeta; j++) row[j]=tables[t][i][j];
+			fwrite(row,sizeof(double),this->nbeta+1,fp);
+		}
+	}
+	delete [] row;
+
+	int ok = !ferror(fp);
+	if (fclose(fp) != 0) ok=0;
+	if (ok && rename(tmpname,s) == 0) return 1;
+	remove(tmpname);
+	return 0;
+}
+
+
 double Crust::crust_heating(int i) 
 // calculates the crust heating for grid point i
 // units are erg/g/s  divided by (mdot*g)
@@ -684,7 +1187,7 @@ double Crust::crust_heating(int i)
 		
 		{ // the above assumed 1e25 erg/cm^3 deposited energy; now apply a multiplier as specified in the inlist.dat
 			double ener;
-			if (this->grid[i].rho>4e11) ener = this->energy_deposited_inner;
+			if (this->grid[i].rho>4e11) ener = this->Einner_eff;
 			else ener = this->energy_deposited_outer;
 			ener *= pow(this->grid[i].rho/1e10,this->energy_slope);
 			eps *= ener;
@@ -768,10 +1271,17 @@ void Crust::derivs(double t, double T[], double dTdt[])
   	dTdt[this->N+1] = (-this->grid[this->N+1].F * 4.0*M_PI*pow(1e5*this->radius,2.0) - this->grid[this->N+1].NU) / this->grid[this->N+1].CP;
 }
 
+int Crust::cooling_boundary(void)
+// whether the flux at the top of the grid is the flux from the surface, rather than
+// coming from the temperature at the top (which is fixed while accreting)
+{
+	return !(this->heating && this->outburst_duration > 1.0/365.0 && !this->force_cooling_bc);
+}
+
 double Crust::calculate_heat_flux(int i, double *T)
 {
 	double flux;
-	if (i>1 || (this->heating && this->outburst_duration > 1.0/365.0 && !this->force_cooling_bc))
+	if (i>1 || !cooling_boundary())
 //		if (i>1 || (this->accreting && EOS->B == 0.0))   
 		// use this inside the grid, or at the surface when we are accreting (which 
 		// fixes the outer temperature)
@@ -781,43 +1291,95 @@ double Crust::calculate_heat_flux(int i, double *T)
 			flux = 0.5*(this->grid[i].K+this->grid[i-1].K)*(T[i]-T[i-1])/this->dx;	
 	else {
 		// cooling boundary condition
-		if (EOS->B == 0.0 || this->use_my_envelope) {
-			// from my envelope calculation (makegrid.cc)
-			flux = (this->g/2.28e14)*TEFF.get(T[i]);
-		} else {
-			// for magnetars we use
-			// Potekhin & Yakovlev 2001 eq.(27)
-			double T9 = T[i]*1e-9;
-			double xi = T9 - 0.001*pow(1e-14*this->g,0.25)*sqrt(7.0*T9);
-			flux = 5.67e-5 * 1e24 * this->g*1e-14 * (pow(7*xi,2.25)+pow(0.333*xi,1.25));
+		flux = surface_flux(T[i],NULL);
+	}
 		
-			// or use makegrid.cc calculation
-			//flux = (this->g/2.28e14)*TEFF.get(T[i]);
-			
-			
-			// now correct for B ... 
-			if (this->angle_mu >= 0.0) {
-				// use the enhancement along the field direction
-				double B12=EOS->B*1e-12;
-				double chi1 = 1.0 + 0.0492*pow(B12,0.292)/pow(T9,0.24);
-				//double chi2 = sqrt(1.0 + 0.1076*B12*pow(0.03+T9,-0.559))/
-				//			pow(1.0+0.819*B12/(0.03+T9),0.6463);
-				double fcond = 4.0*this->angle_mu*this->angle_mu/(1.0+3.0*this->angle_mu*this->angle_mu);		
-				flux *= fcond*pow(chi1,4.0);//+(1.0-fcond)*pow(chi2,4.0);
+	return flux;
+}
 
-			} else {
-				// or use eq. (31) or PY2001  which gives F(B)/F(0)
-				double fac, a1,a2,a3,beta;
-				beta = 0.074*sqrt(1e-12*EOS->B)*pow(T9,-0.45);
-				a1=5059.0*pow(T9,0.75)/sqrt(1.0 + 20.4*sqrt(T9) + 138.0*pow(T9,1.5) + 1102.0*T9*T9);
-				a2=1484.0*pow(T9,0.75)/sqrt(1.0 + 90.0*pow(T9,1.5)+ 125.0*T9*T9);
-				a3=5530.0*pow(T9,0.75)/sqrt(1.0 + 8.16*sqrt(T9) + 107.8*pow(T9,1.5)+ 560.0*T9*T9);
-				fac = (1.0 + a1*beta*beta + a2*pow(beta,3.0) + 0.007*a3*pow(beta,4.0))/(1.0+a3*beta*beta);
-				flux *= fac;
-			}
-		}
+
+double Crust::surface_flux(double T, double *dFdT)
+// flux from the surface for temperature T at the top of the grid, looked up in the
+// table made by make_surface_flux_table. If dFdT is not NULL, it is set to dF/dT.
+// Outside the table the flux is extrapolated as a power law from the end of the
+// table; surface_flux_exact can't be used here because it needs TEFF, which only
+// the crust that made the table has (crusts sharing the model don't).
+{
+	double u = (log10(T)-this->lgTflux_min)/this->dlgTflux;
+	if (isnan(u)) {
+		if (dFdT != NULL) *dFdT = NAN;
+		return NAN;
 	}
+	if (u < 0.0 || u >= this->nflux-1) {
+		int k = (u < 0.0) ? 0 : this->nflux-2;
+		double F1 = this->flux_table[k], F2 = this->flux_table[k+1];
+		double F0 = (u < 0.0) ? F1 : F2, lgT0 = this->lgTflux_min + ((u < 0.0) ? k : k+1)*this->dlgTflux;
+		double n = (F1 > 0.0 && F2 > 0.0) ? log10(F2/F1)/this->dlgTflux : 0.0;
+		double F = F0*pow(10.0,n*(log10(T)-lgT0));
+		if (dFdT != NULL) *dFdT = n*F/T;
+		return F;
+	}
+	int k = (int) u;
+	double F1 = this->flux_table[k], F2 = this->flux_table[k+1];
+	if (dFdT != NULL) *dFdT = (F2-F1)/(this->dlgTflux*2.302585*T);
+	return F1 + (F2-F1)*(u-k);
+}
+
+
+void Crust::make_surface_flux_table(void)
+// tabulates the surface flux on a grid uniform in log10 T, so that looking it up
+// in calculate_heat_flux and when outputting Teff needs only one log10.
+// The flux is interpolated linearly in log T; with steps of 0.001 dex the error is 
+// at the 1e-6 level.
+{
+	this->nflux = 4501;
+	this->lgTflux_min = 5.5;
+	this->dlgTflux = 0.001;    // covers 5.5 <= log10 T <= 10
+	this->flux_table = new double [this->nflux];   // (the model takes it over)
+	for (int k=0; k<this->nflux; k++)
+		this->flux_table[k] = surface_flux_exact(pow(10.0,this->lgTflux_min + k*this->dlgTflux));
+}
+
+
+double Crust::surface_flux_exact(double T)
+// calculates the flux from the surface for temperature T at the top of the grid
+{
+	double flux;
+	if (EOS->B == 0.0 || this->use_my_envelope) {
+		// from my envelope calculation (makegrid.cc)
+		flux = (this->g/this->envelope_g)*TEFF.get(T);
+	} else {
+		// for magnetars we use
+		// Potekhin & Yakovlev 2001 eq.(27)
+		double T9 = T*1e-9;
+		double xi = T9 - 0.001*pow(1e-14*this->g,0.25)*sqrt(7.0*T9);
+		flux = 5.67e-5 * 1e24 * this->g*1e-14 * (pow(7*xi,2.25)+pow(0.333*xi,1.25));
+	
+		// or use makegrid.cc calculation
+		//flux = (this->g/2.28e14)*TEFF.get(T[i]);
+		
 		
+		// now correct for B ... 
+		if (this->angle_mu >= 0.0) {
+			// use the enhancement along the field direction
+			double B12=EOS->B*1e-12;
+			double chi1 = 1.0 + 0.0492*pow(B12,0.292)/pow(T9,0.24);
+			//double chi2 = sqrt(1.0 + 0.1076*B12*pow(0.03+T9,-0.559))/
+			//			pow(1.0+0.819*B12/(0.03+T9),0.6463);
+			double fcond = 4.0*this->angle_mu*this->angle_mu/(1.0+3.0*this->angle_mu*this->angle_mu);		
+			flux *= fcond*pow(chi1,4.0);//+(1.0-fcond)*pow(chi2,4.0);
+
+		} else {
+			// or use eq. (31) or PY2001  which gives F(B)/F(0)
+			double fac, a1,a2,a3,beta;
+			beta = 0.074*sqrt(1e-12*EOS->B)*pow(T9,-0.45);
+			a1=5059.0*pow(T9,0.75)/sqrt(1.0 + 20.4*sqrt(T9) + 138.0*pow(T9,1.5) + 1102.0*T9*T9);
+			a2=1484.0*pow(T9,0.75)/sqrt(1.0 + 90.0*pow(T9,1.5)+ 125.0*T9*T9);
+			a3=5530.0*pow(T9,0.75)/sqrt(1.0 + 8.16*sqrt(T9) + 107.8*pow(T9,1.5)+ 560.0*T9*T9);
+			fac = (1.0 + a1*beta*beta + a2*pow(beta,3.0) + 0.007*a3*pow(beta,4.0))/(1.0+a3*beta*beta);
+			flux *= fac;
+		}
+	}
 	return flux;
 }
 
@@ -877,7 +1439,15 @@ void Crust::jacobn(double t, double *T, double *dfdt, double **dfdT, int n)
   {
 	int i=1;
 	T[i]*=1.0+e; f=dTdt(i,T);
-	T[i]/=1.0+e; dfdT[i][i]=(f-dfdt[i])/(T[i]*e);
+	T[i]/=1.0+e;
+	if (cooling_boundary()) {
+		// the surface flux has an analytic derivative, so use it instead of the
+		// difference of the flux over the step (CP and K are still at T(1+e))
+		double dFdT, F=surface_flux(T[i],&dFdT);
+		double dF=surface_flux(T[i]*(1.0+e),NULL)-F;
+		f += this->g*pow(this->grid[0].r/this->grid[i].r,4.0)*(dF-dFdT*T[i]*e)/(this->dx*this->grid[i].CP*this->grid[i].P);
+	}
+	dfdT[i][i]=(f-dfdt[i])/(T[i]*e);
 	T[i+1]*=1.0+e; f=dTdt(i,T);
 	T[i+1]/=1.0+e; dfdT[i][i+1]=(f-dfdt[i])/(T[i+1]*e);
   }
@@ -913,7 +1483,9 @@ void Crust::calculate_vars(int i)
 	if (beta < this->betamin) beta = this->betamin;
 		
 		// lookup values in the precalculated table
+	// (at betamax the last interval is used, so that j+1 stays inside the table)
 	int j = 1 + (int) ((beta-this->betamin)/this->deltabeta);
+	if (j > this->nbeta-1) j=this->nbeta-1;
 	double interpfac=(beta-(this->betamin + (j-1)*this->deltabeta))/this->deltabeta;
 	// interpolate the thermal conductivity to the current
 	// value of impurity parameter Q
@@ -926,7 +1498,7 @@ void Crust::calculate_vars(int i)
 	// use something like this next line to hardwire Q values
 	double Qval;
 	if (this->hardwireQ) {
-		if (this->grid[i].rho > this->Qrho) Qval=this->Qinner; else Qval=EOS->Qimp;
+		if (this->grid[i].rho > this->Qrho) Qval=this->Qinner_eff; else Qval=EOS->Qimp;
 //		if (P>2.28e29) Qval=this->Qinner; else Qval=EOS->Qimp;
 	} else {
 		Qval = this->grid[i].Qimpur;	
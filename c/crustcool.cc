@@ -1,21 +1,163 @@
 // crustcool.cc
 //
+//   crustcool [name [1]]       runs the model in init.dat (or init/init.dat.name,
+//                              or /tmp/init.dat.name)
+//   crustcool --serve <socket> [name]
+//                              sets up the model and then runs parameter sets
+//                              sent to it over a socket (see serve.cc)
+//   crustcool --batch <manifest> [-j nthreads] [name]
+//                              runs the models listed in the manifest on a
+//                              thread pool (see batch.cc)
+//   crustcool --ensemble <file> [name]
+//                              evolves the models listed in the file, which
+//                              differ only in Qimp, Qinner, Tc, Tt and mdot,
+//                              together (see ensemble.cc)
+//   crustcool --sample <chain> [-j nthreads] [-w nwalkers] [-n nsteps] [-s seed]
+//             [-t ntemps] [-T tmax] [name]
+//                              samples the parameters that have priors in the
+//                              init file with an ensemble MCMC, with parallel
+//                              tempering if ntemps > 1 (see sampler.cc)
+//   crustcool --nested <samples> [-j nthreads] [-l nlive] [-m nwalk] [-s seed] [name]
+//                              calculates the evidence by nested sampling over the
+//                              same priors (see nested.cc)
+//   crustcool --fit <file> [-j nthreads] [name]
+//                              finds the best fit to the data for the same
+//                              parameters, and its covariance (see fit.cc)
+//   crustcool --fisher <file> [-j nthreads] [name]
+//                              the covariance from the Fisher matrix at the
+//                              parameters in the init file (see fit.cc)
+//   crustcool --emulate <file> [-j nthreads] [-n ntrain] [-s seed] [name]
+//                              trains an emulator of the model over the priors
+//                              for the samplers (see emulator.cc)
+//   crustcool --rom <file> [-j nthreads] [-n ntrain] [-r rank] [-s seed] [name]
+//                              builds a reduced-order model of the outburst and
+//                              cooling from full runs over the priors (see rom.cc)
+//
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <math.h>
-#include "../h/crust.h"
-#include "../h/data.h"
-
-void parse_parameters(char *fname,char *sourcename,Crust &crust,double &,int &, int&, int &);
-void set_up_initial_temperature_profile_piecewise(char *fname, Crust &crust);
+#include <unistd.h>
+#include "../h/run.h"
+#include "../h/serve.h"
+#include "../h/batch.h"
+#include "../h/ensemble.h"
+#include "../h/sampler.h"
+#include "../h/nested.h"
+#include "../h/fit.h"
+#include "../h/emulator.h"
+#include "../h/rom.h"
 
 
 int main(int argc, char *argv[])
 {
 	// Initialize the crust
-	Crust crust;
-	
+	Run run;
+
+	// server, batch and ensemble modes
+	const char *serve_path=NULL, *manifest=NULL, *ensemble=NULL, *chain=NULL, *nested=NULL,
+		*fitname=NULL, *fishername=NULL, *emuname=NULL, *romname=NULL;
+	int nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	if (argc >= 3 && !strcmp(argv[1],"--serve")) {
+		serve_path=argv[2];
+		argc-=2; argv+=2;
+	}
+	if (argc >= 3 && !strcmp(argv[1],"--batch")) {
+		manifest=argv[2];
+		argc-=2; argv+=2;
+		if (argc >= 3 && !strcmp(argv[1],"-j")) {
+			nthreads=atoi(argv[2]);
+			argc-=2; argv+=2;
+		}
+	}
+
+	if (argc >= 3 && !strcmp(argv[1],"--ensemble")) {
+		ensemble=argv[2];
+		argc-=2; argv+=2;
+	}
+
+	SamplerOptions opt;
+	opt.nwalkers=0; opt.nsteps=1000; opt.ntemps=1; opt.seed=1; opt.tmax=0.0;
+	if (argc >= 3 && !strcmp(argv[1],"--sample")) {
+		chain=argv[2];
+		argc-=2; argv+=2;
+		while (argc >= 3 && argv[1][0] == '-') {
+			if (!strcmp(argv[1],"-j")) nthreads=atoi(argv[2]);
+			else if (!strcmp(argv[1],"-w")) opt.nwalkers=atoi(argv[2]);
+			else if (!strcmp(argv[1],"-n")) opt.nsteps=atoi(argv[2]);
+			else if (!strcmp(argv[1],"-s")) opt.seed=strtoul(argv[2],NULL,10);
+			else if (!strcmp(argv[1],"-t")) opt.ntemps=atoi(argv[2]);
+			else if (!strcmp(argv[1],"-T")) opt.tmax=atof(argv[2]);
+			else break;
+			argc-=2; argv+=2;
+		}
+	}
+
+	int nlive=0, nwalk=0;
+	if (argc >= 3 && !strcmp(argv[1],"--nested")) {
+		nested=argv[2];
+		argc-=2; argv+=2;
+		while (argc >= 3 && argv[1][0] == '-') {
+			if (!strcmp(argv[1],"-j")) nthreads=atoi(argv[2]);
+			else if (!strcmp(argv[1],"-l")) nlive=atoi(argv[2]);
+			else if (!strcmp(argv[1],"-m")) nwalk=atoi(argv[2]);
+			else if (!strcmp(argv[1],"-s")) opt.seed=strtoul(argv[2],NULL,10);
+			else break;
+			argc-=2; argv+=2;
+		}
+		// the live points are replaced in batches of at most nlive/2
+		if (nlive != 0 && nlive < 2) {
+			printf("The number of live points (-l) must be at least 2\n");
+			exit(1);
+		}
+	}
+
+	if (argc >= 3 && !strcmp(argv[1],"--fit")) {
+		fitname=argv[2];
+		argc-=2; argv+=2;
+		if (argc >= 3 && !strcmp(argv[1],"-j")) {
+			nthreads=atoi(argv[2]);
+			argc-=2; argv+=2;
+		}
+	}
+
+	if (argc >= 3 && !strcmp(argv[1],"--fisher")) {
+		fishername=argv[2];
+		argc-=2; argv+=2;
+		if (argc >= 3 && !strcmp(argv[1],"-j")) {
+			nthreads=atoi(argv[2]);
+			argc-=2; argv+=2;
+		}
+	}
+
+	int ntrain=0;
+	if (argc >= 3 && !strcmp(argv[1],"--emulate")) {
+		emuname=argv[2];
+		argc-=2; argv+=2;
+		while (argc >= 3 && argv[1][0] == '-') {
+			if (!strcmp(argv[1],"-j")) nthreads=atoi(argv[2]);
+			else if (!strcmp(argv[1],"-n")) ntrain=atoi(argv[2]);
+			else if (!strcmp(argv[1],"-s")) opt.seed=strtoul(argv[2],NULL,10);
+			else break;
+			argc-=2; argv+=2;
+		}
+	}
+
+	int rank=0;
+	if (argc >= 3 && !strcmp(argv[1],"--rom")) {
+		romname=argv[2];
+		argc-=2; argv+=2;
+		while (argc >= 3 && argv[1][0] == '-') {
+			if (!strcmp(argv[1],"-j")) nthreads=atoi(argv[2]);
+			else if (!strcmp(argv[1],"-n")) ntrain=atoi(argv[2]);
+			else if (!strcmp(argv[1],"-r")) rank=atoi(argv[2]);
+			else if (!strcmp(argv[1],"-s")) opt.seed=strtoul(argv[2],NULL,10);
+			else break;
+			argc-=2; argv+=2;
+		}
+	}
+
 	// Get input parameters
 	// determine the filename for the 'init.dat' parameter file
 	char fname[200]="";
@@ -34,161 +176,47 @@ int main(int argc, char *argv[])
 	}
 
 	// parse the input file
-	char sourcename[200]="1659";
-	double time_to_run=1e4;
-	int use_piecewise=0, output_heating=0, output_cooling=1;
-	parse_parameters(fname,sourcename,crust,time_to_run,use_piecewise,output_heating,output_cooling);
+	if (!run.read_parameters(fname)) exit(1);
 
-	printf("============================================\n");
-			
-	// Setup the crust
-	crust.setup();
-	
-	// Evolve the crust in time
-	
-	// Heating phase 
-	if (use_piecewise) {
-		// initial temperature profile was specified in the init.dat file
-		set_up_initial_temperature_profile_piecewise(fname,crust);
-	} else {
-		// evolve the crust while heating
-		crust.output=output_heating;   // default is to not output the lightcurve while heating
-		// now evolve for the set outburst_duration and mdot
-		// if these were not specified in the init.dat file,
-		// then they have default values of 1 hour and mdot=1.0 which is used for the 
-		// magnetar case (rapid heating)
-		crust.evolve(crust.outburst_duration*365.0,crust.mdot);
+	if (serve_path != NULL) {
+		serve(run,serve_path);
+		return 0;
 	}
-
-	// Cooling phase
-	if (time_to_run > 0.0) {
-		crust.output=output_cooling;
-		crust.evolve(time_to_run,0.0);
-	}
-	
-	// Calculate the chi-sq
-	Data data;
-	data.read_in_data(sourcename);
-	data.calculate_chisq(crust);
-}
-
-
-
-
-
-void parse_parameters(char *fname,char *sourcename,Crust &crust,double &time_to_run,int &use_piecewise,
-			int &output_heating, int &output_cooling) {
- 	// Set parameters
-	printf("Reading input data from %s\n",fname);
-	FILE *fp = fopen(fname,"r");
-	char s[200];
-	char s1[200];
-	char s2[200];
-	char includename[200]="";
-	double x;				
-	int commented=0;
-	while (!feof(fp)) {   // we read the file line by line
-		(void) fgets(s1,200,fp);		
-		// ignoring lines that begin with \n (blank) or with # (comments)
-		// or with $ (temperature profile)
-		if (!strncmp(s1,"##",2)) commented = 1-commented;
-		if (!strncmp(s1,"<",1)) {   // include another init file
-			sscanf(s1,"%s\t%s\n",s,s2);
-			strcat(includename,"init/init.dat.");
-			strcat(includename,s2);			
-			parse_parameters(includename,sourcename,crust,time_to_run,use_piecewise,output_heating,output_cooling);
-		}
-		if (strncmp(s1,"#",1) && strncmp(s1,"\n",1) && strncmp(s1,">",1) && commented==0) {
-			sscanf(s1,"%s\t%lg\n",s,&x);
-			if (!strncmp(s,"Bfield",6)) crust.B=x;
-			if (!strncmp(s,"Tc",2)) crust.Tc=x;
-			if (!strncmp(s,"Tt",2)) crust.Tt=x;
-			if (!strncmp(s,"SFgap",5)) crust.gap=(int) x;
-			if (!strncmp(s,"ngrid",5)) crust.N=(int) x;
-			if (!strncmp(s,"kncrit",6)) crust.kncrit=x;
-			if (!strncmp(s,"mdot",4)) crust.mdot=x;
-			if (!strncmp(s,"mass",4)) crust.mass=x;
-			if (!strncmp(s,"C_core",6)) crust.C_core=x;
-			if (!strncmp(s,"Lnu_core_alpha",14)) crust.Lnu_core_alpha=x;
-			if (!strncmp(s,"Lnu_core_norm",13)) crust.Lnu_core_norm=x;
-			if (!strncmp(s,"gpe",3)) crust.gpe=(int) x;
-			if (!strncmp(s,"radius",6)) crust.radius=x;
-			if (!strncmp(s,"Edep",4)) crust.energy_deposited_outer=x;
-			if (!strncmp(s,"ytop",4)) crust.yt=x;
-			if (!strncmp(s,"Einner",6)) crust.energy_deposited_inner=x;
-			if (!strncmp(s,"resume",6)) crust.resume=x;
-			if (!strncmp(s,"Qimp",4)) crust.Qimp=x;
-			if (!strncmp(s,"Qrho",4)) crust.Qrho=x;
-			if (!strncmp(s,"rhob",4)) crust.rhob=x;
-			if (!strncmp(s,"rhot",4)) crust.rhot=x;
-			if (!strncmp(s,"precalc",7)) crust.force_precalc=(int) x;
-			if (!strncmp(s,"Qinner",6)) crust.Qinner=x;
-			if (!strncmp(s,"output_cooling",14)) output_cooling=x;
-			if (!strncmp(s,"output_heating",14)) output_heating=x;
-			if (!strncmp(s,"timetorun",9)) time_to_run=x;			
-			if (!strncmp(s,"toutburst",9)) crust.outburst_duration=x;
-			if (!strncmp(s,"piecewise",9)) use_piecewise=(int) x;
-			if (!strncmp(s,"neutrinos",9)) crust.nuflag=(int) x;
-			if (!strncmp(s,"accreted",8)) crust.accr=(int) x;
-			if (!strncmp(s,"angle_mu",8)) crust.angle_mu=x;
-			if (!strncmp(s,"cooling_bc",10)) crust.force_cooling_bc=(int) x;
-			if (!strncmp(s,"extra_heating",13)) crust.extra_heating=(int) x;
-			if (!strncmp(s,"deep_heating_factor",19)) crust.deep_heating_factor=x;
-			if (!strncmp(s,"energy_slope",12)) crust.energy_slope=x;
-			if (!strncmp(s,"potek_eos",9)) crust.use_potek_eos=(int) x;
-			if (!strncmp(s,"envelope",8)) crust.use_my_envelope=(int) x;
-			if (!strncmp(s,"extra_Q",7)) crust.extra_Q=x;
-			if (!strncmp(s,"extra_y",7)) crust.extra_y=x;
-			if (!strncmp(s,"Lscale",6)) crust.Lscale=x;
-			if (!strncmp(s,"Lmin",4)) crust.Lmin=x;
-			if (!strncmp(s,"source",6)) {
-				sscanf(s1,"%s\t%s\n",s,sourcename);
-			}
-		}
+	if (manifest != NULL) {
+		run_batch(run,manifest,nthreads);
+		return 0;
+	}
+	if (ensemble != NULL) {
+		run_ensemble(run,ensemble);
+		return 0;
+	}
+	if (chain != NULL) {
+		run_sampler(run,chain,nthreads,opt);
+		return 0;
+	}
+	if (nested != NULL) {
+		run_nested(run,nested,nthreads,nlive,nwalk,opt.seed);
+		return 0;
+	}
+	if (fitname != NULL) {
+		run_fit(run,fitname,nthreads);
+		return 0;
+	}
+	if (fishername != NULL) {
+		run_fisher(run,fishername,nthreads);
+		return 0;
+	}
+	if (emuname != NULL) {
+		run_emulate(run,emuname,nthreads,ntrain,opt.seed);
+		return 0;
+	}
+	if (romname != NULL) {
+		run_rom(run,romname,nthreads,ntrain,rank,opt.seed);
+		return 0;
 	}
 
-	fclose(fp);	
-}
-
-
-
-
-void set_up_initial_temperature_profile_piecewise(char *fname,Crust &crust)
-{
-	// first read in the specified temperature-density relation from the file
-	FILE *fp;
-	char s1[100];  // string to hold each line of the file
-	printf("Reading initial temperature profile from %s\n",fname);
-	fp = fopen(fname,"r");
-	double rhovec[101],Tvec[101];  // temperature and density points 
-	rhovec[0]=0.0; Tvec[0]=0.0;   // send "0.0" for the top density and temperature
-								// Crust converts this to the right values
-	int commented=0;
-	int i=1;
-	while (!feof(fp)) {	
-		double rho, T,T2=0.0;
-		// new lines: read from lines marked ">" in init.dat
-		(void) fgets(s1,200,fp);
-		if (!strncmp(s1,"##",2)) commented = 1-commented;
-		if (!strncmp(s1,">",1) && commented==0) {
-			int nvar = sscanf(s1,">%lg\t%lg\t%lg\n",&rho,&T,&T2);
-			rhovec[i] = rho;
-			Tvec[i] = T;
-			i++;
-			if (nvar == 3) {
-				rhovec[i] = rho*1.01;
-				Tvec[i] = T2;
-				i++;
-			}
-		}			
-	}
-	fclose(fp);
-	int nvec=i;
-	if (nvec == 1) {
-		printf("ERROR:The piecewise flag is set but the temperature profile is not specified in init.dat!\n");
-		exit(0);
-	}
-	
-	crust.set_temperature_profile(rhovec,Tvec,nvec);
-
+	// Setup the crust, evolve it through the outburst and cooling,
+	// and calculate the chi-sq
+	run.setup();
+	run.run();
 }
@@ -0,0 +1,276 @@
+// crustcool_mpi.cc
+//
+// MPI driver for large ensembles of models, e.g. the walkers of an MCMC fit
+// spread over several nodes (build with 'make crustcool_mpi')
+//
+//   mpirun -n <ranks> ./crustcool_mpi <sets> [-j nthreads] [-b batch] [-e epochs] [name]
+//
+// The first line of <sets> names the parameters that are varied, and each
+// following line gives their values for one model, e.g.
+//
+//     Tc     Qimp   Tt
+//     3e7    1.0    4e8
+//     3.5e7  2.0    4e8
+//
+// The other parameters come from init.dat (or init/init.dat.name) as usual,
+// which every rank reads and sets up once. Rank 0 reads the sets, and they are
+// sent out with MPI_Scatterv in batches of <batch> models (default all of them).
+// Each rank runs its share on a work-stealing pool of nthreads threads (default
+// the number of cores / ranks on the node) with warm Runs that share the rank's
+// crust model, and the chi-squared values and lightcurves are collected on rank 0
+// with MPI_Gatherv.
+//
+// Rank 0 writes "<line> <chisq> <y1> ... <yn>" to stdout for each model, where
+// y is the model Teff (eV) or luminosity at the epochs (observer days) listed in
+// the file <epochs>, or at the times of the data if there is no epochs file.
+// A model that fails (e.g. an envelope that can't be calculated) gives nan for
+// chisq and the lightcurve, and the rest carry on. Everything else goes to stderr.
+//
+// The ranks don't need to share anything but the parameter files, so it runs the
+// same way on one machine (e.g. mpirun -n 2 ./crustcool_mpi sets -j 2).
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <mpi.h>
+#include "../h/run.h"
+#include "../h/pool.h"
+#include "../h/spline.h"
+#include "../h/fail.h"
+#include "../h/timer.h"
+
+static void read_sets(const char *fname, std::vector<std::string> &keys, std::vector<double> &values,
+	std::vector<int> &lines);
+static void read_epochs(const char *fname, std::vector<double> &epochs);
+
+
+int main(int argc, char *argv[])
+{
+	int provided, rank, nranks;
+	MPI_Init_thread(&argc,&argv,MPI_THREAD_FUNNELED,&provided);
+	MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+	MPI_Comm_size(MPI_COMM_WORLD,&nranks);
+
+	if (argc < 2) {
+		if (rank == 0) printf("usage: crustcool_mpi <sets> [-j nthreads] [-b batch] [-e epochs] [name]\n");
+		MPI_Finalize();
+		return 1;
+	}
+	const char *setsname=argv[1], *epochname=NULL;
+	argc--; argv++;
+	int nthreads=0, batch=0;
+	while (argc >= 3 && argv[1][0] == '-') {
+		if (!strcmp(argv[1],"-j")) nthreads=atoi(argv[2]);
+		else if (!strcmp(argv[1],"-b")) batch=atoi(argv[2]);
+		else if (!strcmp(argv[1],"-e")) epochname=argv[2];
+		else break;
+		argc-=2; argv+=2;
+	}
+	if (nthreads <= 0) {
+		// share the node's cores between the ranks on it
+		MPI_Comm node;
+		int nlocal;
+		MPI_Comm_split_type(MPI_COMM_WORLD,MPI_COMM_TYPE_SHARED,rank,MPI_INFO_NULL,&node);
+		MPI_Comm_size(node,&nlocal);
+		MPI_Comm_free(&node);
+		nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN) / nlocal;
+		if (nthreads < 1) nthreads=1;
+	}
+
+	// results go to stdout on rank 0, so move everything else to stderr
+	fflush(stdout);
+	FILE *out = NULL;
+	if (rank == 0) out = fdopen(dup(1),"w");
+	dup2(2,1);
+
+	// every rank sets up the base model
+	char fname[200]="";
+	switch(argc) {
+		case 3:
+			strcat(fname,"/tmp/init.dat.");
+			strcat(fname,argv[1]);
+			break;
+		case 2:
+			strcat(fname,"init/init.dat.");
+			strcat(fname,argv[1]);
+			break;
+		default:
+			strcat(fname,"init.dat");
+	}
+	Run base;
+	if (!base.read_parameters(fname)) MPI_Abort(MPI_COMM_WORLD,1);
+	base.output_heating=0;
+	base.output_cooling=0;
+	base.crust.output=0;
+	base.setup();
+
+	// parameter sets and epochs are read on rank 0 and sent to the others
+	std::vector<std::string> keys;
+	std::vector<double> values, epochs;
+	std::vector<int> lines;
+	int sizes[3]={0,0,0};    // nkeys, nsets, nepochs
+	if (rank == 0) {
+		read_sets(setsname,keys,values,lines);
+		if (epochname != NULL) read_epochs(epochname,epochs);
+		else for (int i=1; i<=base.data.n; i++) epochs.push_back(base.data.t[i]);
+		sizes[0]=(int) keys.size();
+		sizes[1]=(int) lines.size();
+		sizes[2]=(int) epochs.size();
+	}
+	MPI_Bcast(sizes,3,MPI_INT,0,MPI_COMM_WORLD);
+	int nkeys=sizes[0], nsets=sizes[1], nepochs=sizes[2];
+
+	std::vector<char> keybuf(64*nkeys,'\0');
+	if (rank == 0) for (int p=0; p<nkeys; p++) strncpy(&keybuf[64*p],keys[p].c_str(),63);
+	MPI_Bcast(keybuf.data(),64*nkeys,MPI_CHAR,0,MPI_COMM_WORLD);
+	if (rank != 0) for (int p=0; p<nkeys; p++) keys.push_back(&keybuf[64*p]);
+	epochs.resize(nepochs);
+	MPI_Bcast(epochs.data(),nepochs,MPI_DOUBLE,0,MPI_COMM_WORLD);
+
+	if (batch <= 0) batch=nsets;
+	if (rank == 0) printf("Running %d models on %d ranks x %d threads\n", nsets, nranks, nthreads);
+	double start=wall_time();
+
+	std::vector<Run *> workers(nthreads,(Run *) NULL);
+	std::vector<int> counts(nranks), displs(nranks), vcounts(nranks), vdispls(nranks),
+		lcounts(nranks), ldispls(nranks);
+	std::vector<double> chisq(batch), lc((size_t) batch*nepochs);
+	{
+		ThreadPool pool(nthreads);
+		for (int first=0; first<nsets; first+=batch) {
+			// split the batch as evenly as possible between the ranks
+			int count = (nsets-first < batch) ? nsets-first : batch;
+			for (int r=0; r<nranks; r++) {
+				counts[r] = count/nranks + (r < count%nranks ? 1 : 0);
+				displs[r] = (r == 0) ? 0 : displs[r-1]+counts[r-1];
+				vcounts[r]=counts[r]*nkeys; vdispls[r]=displs[r]*nkeys;
+				lcounts[r]=counts[r]*nepochs; ldispls[r]=displs[r]*nepochs;
+			}
+			int n=counts[rank];
+			std::vector<double> mine((size_t) n*nkeys), mychisq(n), mylc((size_t) n*nepochs);
+			MPI_Scatterv(rank == 0 ? &values[(size_t) first*nkeys] : NULL,vcounts.data(),vdispls.data(),MPI_DOUBLE,
+				mine.data(),n*nkeys,MPI_DOUBLE,0,MPI_COMM_WORLD);
+
+			for (int k=0; k<n; k++) {
+				pool.submit([&,k](int w) {
+					// each worker's Run is set up on its first model
+					if (workers[w] == NULL) workers[w] = new Run;
+					Run *run = workers[w];
+					run->copy_parameters(base);
+					for (int p=0; p<nkeys; p++) run->set_parameter(keys[p].c_str(),mine[(size_t) k*nkeys+p]);
+					run->output_heating=0;
+					run->output_cooling=0;
+					run->crust.output=0;
+					// a model that fails gives NAN rather than ending the job
+					fail_by_throwing(1);
+					try {
+						if (run->needs_setup) {
+							if (run->same_setup(base)) run->setup_from(base);
+							else run->setup();
+						}
+						mychisq[k] = run->run();
+					} catch (Failure &e) {
+						fail_by_throwing(0);
+						printf("Parameter set %d failed: %s\n", first+displs[rank]+k+1, e.message);
+						run->invalidate(STAGE_SETUP);
+						mychisq[k]=NAN;
+						for (int e=0; e<nepochs; e++) mylc[(size_t) k*nepochs+e]=NAN;
+						return;
+					}
+					fail_by_throwing(0);
+
+					// the lightcurve at the epochs, interpolated as for chi-squared
+					Spline curve;
+					curve.minit(run->data.tmodel,run->data.ymodel,run->data.nmodel);
+					for (int e=0; e<nepochs; e++) mylc[(size_t) k*nepochs+e]=curve.get(epochs[e]);
+					curve.tidy();
+				});
+			}
+			pool.wait();
+
+			MPI_Gatherv(mychisq.data(),n,MPI_DOUBLE,chisq.data(),counts.data(),displs.data(),MPI_DOUBLE,
+				0,MPI_COMM_WORLD);
+			MPI_Gatherv(mylc.data(),n*nepochs,MPI_DOUBLE,lc.data(),lcounts.data(),ldispls.data(),MPI_DOUBLE,
+				0,MPI_COMM_WORLD);
+
+			if (rank == 0) {
+				for (int k=0; k<count; k++) {
+					fprintf(out,"%d %.10g",lines[first+k],chisq[k]);
+					for (int e=0; e<nepochs; e++) fprintf(out," %lg",lc[(size_t) k*nepochs+e]);
+					fprintf(out,"\n");
+				}
+				fflush(out);
+			}
+		}
+	}
+
+	if (rank == 0) {
+		printf("Finished %d models in %lg s\n", nsets, wall_time()-start);
+		fclose(out);
+	}
+	for (int w=0; w<nthreads; w++) delete workers[w];
+	MPI_Finalize();
+	return 0;
+}
+
+
+static void read_sets(const char *fname, std::vector<std::string> &keys, std::vector<double> &values,
+	std::vector<int> &lines)
+// reads the parameter names and the values for each model; exits on an error
+{
+	FILE *fp = fopen(fname,"r");
+	if (fp == NULL) {
+		printf("Could not open %s\n", fname);
+		MPI_Abort(MPI_COMM_WORLD,1);
+	}
+	char s[1000], *save;
+	int line=0;
+	while (fgets(s,1000,fp) != NULL) {
+		line++;
+		char *word = strtok_r(s," \t\n",&save);
+		if (word == NULL || word[0] == '#') continue;
+		if (keys.empty()) {
+			// the header line
+			Run check;
+			while (word != NULL) {
+				if (!check.set_parameter(word,0.0)) {
+					printf("%s line %d: unknown parameter %s\n", fname, line, word);
+					MPI_Abort(MPI_COMM_WORLD,1);
+				}
+				keys.push_back(word);
+				word = strtok_r(NULL," \t\n",&save);
+			}
+			continue;
+		}
+		int n=0;
+		while (word != NULL) {
+			values.push_back(atof(word));
+			n++;
+			word = strtok_r(NULL," \t\n",&save);
+		}
+		if (n != (int) keys.size()) {
+			printf("%s line %d: expected %d values\n", fname, line, (int) keys.size());
+			MPI_Abort(MPI_COMM_WORLD,1);
+		}
+		lines.push_back(line);
+	}
+	fclose(fp);
+}
+
+
+static void read_epochs(const char *fname, std::vector<double> &epochs)
+{
+	FILE *fp = fopen(fname,"r");
+	if (fp == NULL) {
+		printf("Could not open %s\n", fname);
+		MPI_Abort(MPI_COMM_WORLD,1);
+	}
+	double t;
+	while (fscanf(fp,"%lg",&t) == 1) epochs.push_back(t);
+	fclose(fp);
+}
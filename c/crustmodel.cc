@@ -0,0 +1,50 @@
+// class CrustModel
+//
+// Shared, reference-counted setup of a crust (see h/crustmodel.h)
+//
+
+#include <sys/mman.h>
+#include "../h/vector.h"
+#include "../h/crustmodel.h"
+
+CrustModel::CrustModel(int N)
+{
+	this->refs=1;
+	this->N=N;
+	this->grid = new GridPoint [N+2];
+	this->nflux=0;
+	this->flux_table=NULL;
+	this->tables_ready=0;
+	this->nbeta=0;
+	this->CP_grid=NULL;
+	this->table_map=NULL;
+	this->table_rows=NULL;
+}
+
+CrustModel::~CrustModel()
+{
+	delete [] this->grid;
+	delete [] this->flux_table;
+	if (this->table_map != NULL) {
+		munmap(this->table_map,this->table_map_size);
+		delete [] this->table_rows;
+	} else if (this->CP_grid != NULL) {
+		free_matrix(this->CP_grid,this->N+2,this->nbeta);
+		free_matrix(this->K1_grid,this->N+2,this->nbeta);
+		free_matrix(this->K0_grid,this->N+2,this->nbeta);
+		free_matrix(this->KAPPA_grid,this->N+2,this->nbeta);
+		free_matrix(this->K1perp_grid,this->N+2,this->nbeta);
+		free_matrix(this->K0perp_grid,this->N+2,this->nbeta);
+		free_matrix(this->NU_grid,this->N+2,this->nbeta);
+	}
+}
+
+void CrustModel::retain(void)
+{
+	this->refs++;
+}
+
+void CrustModel::release(void)
+{
+	if (--this->refs == 0) delete this;
+}
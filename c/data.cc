@@ -3,11 +3,52 @@
 #include <string.h>
 #include "../h/crust.h"
 #include "../h/data.h"
+#include "../h/fail.h"
+
+Data::Data()
+{
+	this->n=0;
+	this->luminosity=0;
+	this->profile_L=0;
+	this->Lfit_a=1.0; this->Lfit_b=0.0; this->Lfitted=0;
+	this->t=NULL; this->TT=NULL; this->Te=NULL;
+	this->nmodel=0; this->nmodel_max=0;
+	this->tmodel=NULL; this->ymodel=NULL;
+	this->pins=0;
+	this->residual=NULL;
+}
+
+Data::~Data()
+{
+	free_data();
+	delete [] this->tmodel;
+	delete [] this->ymodel;
+	for (int k=0; k<(int) this->retired.size(); k++) delete [] this->retired[k];
+}
+
+void Data::unpin(void)
+{
+	if (--this->pins > 0) return;
+	for (int k=0; k<(int) this->retired.size(); k++) delete [] this->retired[k];
+	this->retired.clear();
+}
+
+void Data::free_data(void)
+{
+	delete [] this->t;
+	delete [] this->TT;
+	delete [] this->Te;
+	delete [] this->residual;
+	this->t=NULL; this->TT=NULL; this->Te=NULL;
+	this->residual=NULL;
+	this->n=0;
+}
 
 void Data::read_in_data(const char *sourcename) 
 {
 	printf("\nComparing with data: source = %s\n",sourcename);
 	this->luminosity = 0;
+	free_data();
 	
 	if (1) {    // hardcoded data    
 
@@ -36,12 +77,13 @@ void Data::read_in_data(const char *sourcename)
 	
 	} else {	
 	
-		char fname[100]="data/";
-		strcat(fname,sourcename);
+		char fname[250];
+		snprintf(fname,sizeof(fname),"data/%s",sourcename);
 	
 		printf("Reading data from %s\n", fname);
 	
 		FILE *fp = fopen(fname,"r");
+		if (fp == NULL) fail("Could not open %s", fname);
 	
 		double t0;
 		fscanf(fp, "%lg %d\n", &t0, &this->n);
@@ -61,44 +103,115 @@ void Data::read_in_data(const char *sourcename)
 
 
 
-void Data::calculate_chisq(Crust &crust)	
+double Data::calculate_chisq(Crust &crust)	
 //void Data::calculate_chisq(Ode_Int *ODE, Spline *TEFF, double g, double ZZ, double R,double Lscale,double Lmin)	
 // uses the result of the cooling to calculate chi-squared
+// the model lightcurve is kept in tmodel, ymodel
 {
 	int nmodel = crust.ODE.kount;
+	double *time = new double[nmodel+1];
+	double *Ttop = new double[nmodel+1];
+	for (int k=1; k<=nmodel; k++) {
+		time[k]=crust.ODE.get_x(k);
+		Ttop[k]=crust.ODE.get_y(1,k);
+	}
+	double chisq = calculate_chisq(crust,nmodel,time,Ttop);
+	delete [] time;
+	delete [] Ttop;
+
+	printf("chisq = %lg\n", chisq);
+	printf("chisq_nu = %lg/(%d-3) = %lg\n", chisq, this->n, chisq/(this->n-3));
+	return chisq;
+}
+
+
+double Data::calculate_chisq(Crust &crust, int nmodel, double *time, double *Ttop)
+// chi-squared for a cooling curve given as the temperature at the top of the
+// grid Ttop[1..nmodel] at times time[1..nmodel] (in seconds, star frame)
+{
+	// the buffers are reused between calls, and only grow if they need to (by at
+	// least a factor of 2, so that few are kept while they are pinned)
+	if (nmodel > this->nmodel_max) {
+		if (this->pins > 0) {
+			if (this->tmodel != NULL) this->retired.push_back(this->tmodel);
+			if (this->ymodel != NULL) this->retired.push_back(this->ymodel);
+		} else {
+			delete [] this->tmodel;
+			delete [] this->ymodel;
+		}
+		this->nmodel_max = (nmodel > 2*this->nmodel_max) ? nmodel : 2*this->nmodel_max;
+		this->tmodel = new double[this->nmodel_max+1];
+		this->ymodel = new double[this->nmodel_max+1];
+	}
+	this->nmodel = nmodel;
 	
-	double g=crust.g;
 	double ZZ=crust.ZZ;
 	double R=crust.radius;
-	double Lscale=crust.Lscale;
-	double Lmin=crust.Lmin;
 	
 	// set up a spline which has the prediction for observed Teff vs time 
 	Spline TE;
-	double *yy = new double[nmodel+1];
-	double *xx = new double[nmodel+1];
+	double *yy = this->ymodel;
+	double *xx = this->tmodel;
 	for (int k=1; k<=nmodel; k++) { 
-		xx[k]=crust.ODE.get_x(k)*ZZ/(3600.0*24.0);
+		xx[k]=time[k]*ZZ/(3600.0*24.0);
 		if (this->luminosity) {
-			yy[k] = crust.TEFF.get(crust.ODE.get_y(1,k))*(g/2.28e14) * 4.0*M_PI*1e10*R*R / (ZZ*ZZ);
-			yy[k] = Lscale*yy[k] + (1.0-Lscale)*Lmin;
+			yy[k] = crust.surface_flux(Ttop[k],NULL) * 4.0*M_PI*1e10*R*R / (ZZ*ZZ);
 		} else {
-			yy[k]=1.38e-16*pow((crust.TEFF.get(crust.ODE.get_y(1,k))*(g/2.28e14))/5.67e-5,0.25)/(1.6e-12*ZZ);
+			yy[k]=1.38e-16*pow(crust.surface_flux(Ttop[k],NULL)/5.67e-5,0.25)/(1.6e-12*ZZ);
 		}
 	}
+	double penalty=0.0;
+	if (this->luminosity) {
+		this->Lfitted=0;
+		if (this->profile_L) penalty=profile_luminosity(xx,yy,nmodel);
+		double a=crust.Lscale;
+		double b=(1.0-crust.Lscale)*crust.Lmin;
+		if (this->Lfitted) {
+			a=this->Lfit_a;
+			b=this->Lfit_b;
+		}
+		for (int k=1; k<=nmodel; k++) yy[k] = a*yy[k] + b;
+	}
 	TE.minit(xx,yy,nmodel);
-	delete [] xx;
-	delete [] yy;
 
 	// calculate chisq
+	if (this->residual == NULL) this->residual = new double[this->n+1];
 	double chisq=0.0;
 	for (int i=1; i<=this->n; i++) {
-		chisq += pow((this->TT[i] - TE.get(this->t[i]))/this->Te[i],2.0);	
+		this->residual[i] = (this->TT[i] - TE.get(this->t[i]))/this->Te[i];
+		chisq += this->residual[i]*this->residual[i];
 		//printf("%lg %lg %lg\n", this->t[i], this->TT[i], TE.get(this->t[i]));
 	}
 	TE.tidy();
-	printf("chisq = %lg\n", chisq);
-	printf("chisq_nu = %lg/(%d-3) = %lg\n", chisq, this->n, chisq/(this->n-3));
+	return chisq+penalty;
 }
 
 
+double Data::profile_luminosity(double *xx, double *yy, int nmodel)
+// The model a*L + b, with a = Lscale and b = (1-Lscale)*Lmin, is linear in a and b,
+// so the chisq for the unscaled luminosity yy[1..nmodel] at times xx[1..nmodel] is
+// minimized over them by weighted least squares. Sets Lfit_a and Lfit_b to the
+// best values (crust.Lscale and crust.Lmin are left as they are, since they are
+// parameters of the Run), and returns what has to be added to the minimum chisq to
+// marginalize over a and b instead (with flat priors), which is
+// ln det(curvature matrix) - 2 ln(2 pi), or 0 if profile_L is 1. The penalty is
+// only in the chisq that calculate_chisq returns, not in the residuals.
+{
+	// the linear interpolation commutes with a*L + b, so the unscaled curve can be used
+	Spline L;
+	L.minit(xx,yy,nmodel);
+	double S=0.0, Sx=0.0, Sxx=0.0, Sy=0.0, Sxy=0.0;
+	for (int i=1; i<=this->n; i++) {
+		double w=1.0/(this->Te[i]*this->Te[i]);
+		double l=L.get(this->t[i]);
+		S+=w; Sx+=w*l; Sxx+=w*l*l; Sy+=w*this->TT[i]; Sxy+=w*l*this->TT[i];
+	}
+	L.tidy();
+	double det=S*Sxx-Sx*Sx;
+	if (!(det > 0.0)) return 0.0;    // e.g. a flat lightcurve: use Lscale and Lmin as they are
+	this->Lfit_a=(S*Sxy-Sx*Sy)/det;
+	this->Lfit_b=(Sxx*Sy-Sx*Sxy)/det;
+	this->Lfitted=1;
+	if (this->profile_L == 2) return log(det)-2.0*log(2.0*M_PI);
+	return 0.0;
+}
@@ -0,0 +1,303 @@
+// class Emulator
+//
+// Gaussian process emulator (see h/emulator.h). Every output (the model at one
+// data point) is a Gaussian process with a constant mean, its own variance, and
+// the same squared-exponential correlation
+//     K(a,b) = exp(-sum_d (a_d-b_d)^2/(2 ell_d^2)) + nugget delta_ab
+// so that one Cholesky factor of K serves them all. The mean and variance of
+// each output are set to their maximum likelihood values for given ell and
+// nugget, which leaves the log likelihood
+//     sum_j (-ntrain/2 ln var_j) - (nout/2) ln det K
+// and the ell_d and the nugget are chosen to maximize it by a coordinate search
+// in their logs. The prediction at u is the usual
+//     mean_j = mu_j + k^T K^-1 (y_j-mu_j),  sd_j^2 = var_j (1 + nugget - k^T K^-1 k)
+// with k the correlations of u with the training points.
+//
+// With r_j = (data-mean_j)/error_j, the chi-squared is sum r_j^2, and its
+// uncertainty is that of a sum of squares of Gaussians with standard deviations
+// s_j = sd_j/error_j, sqrt(sum 4 r_j^2 s_j^2 + 2 s_j^4).
+//
+// The emulator file is text: a comment line, "ndim nout ntrain", a line
+// "name min max log" for each prior, a line with the ell_d and the nugget, and
+// then for each training point its ndim unit cube coordinates and nout outputs.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "../h/emulator.h"
+#include "../h/sampler.h"
+#include "../h/vector.h"
+#include "../h/timer.h"
+
+Emulator::Emulator()
+{
+	this->ndim=0;
+	this->nout=0;
+	this->ntrain=0;
+	this->nugget=1e-6;
+}
+
+
+void Emulator::add(const double *u, const double *y)
+// adds a training point
+{
+	for (int d=0; d<this->ndim; d++) this->u.push_back(u[d]);
+	for (int j=0; j<this->nout; j++) this->y.push_back(y[j]);
+	this->ntrain++;
+}
+
+
+double Emulator::correlation(const double *a, const double *b, const double *ell)
+{
+	double s=0.0;
+	for (int d=0; d<this->ndim; d++) {
+		double z=(a[d]-b[d])/ell[d];
+		s+=z*z;
+	}
+	return exp(-0.5*s);
+}
+
+
+double Emulator::factor(const double *ell, double nugget)
+// factors K for these ell and nugget, and sets mu, var and alpha; returns the
+// log likelihood of the training outputs (-infinity if K is singular)
+{
+	int n=this->ntrain, nout=this->nout;
+	this->L.resize(n*n);
+	for (int k=0; k<n; k++) {
+		for (int m=0; m<=k; m++) this->L[k*n+m]=correlation(&this->u[k*this->ndim],&this->u[m*this->ndim],ell);
+		this->L[k*n+k]+=nugget;
+	}
+	if (!cholesky(n,this->L.data())) return -INFINITY;
+
+	double lndet=0.0;
+	for (int k=0; k<n; k++) lndet+=2.0*log(this->L[k*n+k]);
+	double lnlike=-0.5*nout*lndet;
+
+	this->mu.resize(nout);
+	this->var.resize(nout);
+	this->alpha.resize(nout*n);
+	std::vector<double> dy(n);
+	for (int j=0; j<nout; j++) {
+		double m=0.0;
+		for (int k=0; k<n; k++) m+=this->y[k*nout+j];
+		m/=n;
+		for (int k=0; k<n; k++) dy[k]=this->y[k*nout+j]-m;
+		cholesky_solve(n,this->L.data(),dy.data(),&this->alpha[j*n]);
+		double v=0.0;
+		for (int k=0; k<n; k++) v+=dy[k]*this->alpha[j*n+k];
+		v/=n;
+		if (!(v > 0.0)) v=1e-300;    // an output that doesn't change
+		this->mu[j]=m;
+		this->var[j]=v;
+		lnlike-=0.5*n*log(v);
+	}
+	return lnlike;
+}
+
+
+void Emulator::train(void)
+// chooses ell and the nugget, and factors K with them
+{
+	int ndim=this->ndim;
+	if (this->ntrain < 2) {
+		printf("The emulator needs at least 2 training points\n");
+		exit(1);
+	}
+	// p holds ln ell_d and then ln nugget, each kept in a range
+	std::vector<double> p(ndim+1), lo(ndim+1), hi(ndim+1), ell(ndim);
+	for (int d=0; d<ndim; d++) {
+		p[d]=log(0.3);
+		lo[d]=log(0.01);
+		hi[d]=log(10.0);
+	}
+	p[ndim]=log(this->nugget);
+	lo[ndim]=log(1e-10);
+	hi[ndim]=log(1e-2);
+
+	for (int d=0; d<ndim; d++) ell[d]=exp(p[d]);
+	double best=factor(ell.data(),exp(p[ndim]));
+	double step=log(2.0);
+	while (step > 0.01) {
+		int improved=0;
+		for (int d=0; d<=ndim; d++) {
+			for (int sign=-1; sign<=1; sign+=2) {
+				double old=p[d];
+				p[d]=old+sign*step;
+				if (p[d] < lo[d] || p[d] > hi[d]) {
+					p[d]=old;
+					continue;
+				}
+				for (int e=0; e<ndim; e++) ell[e]=exp(p[e]);
+				double lnlike=factor(ell.data(),exp(p[ndim]));
+				if (lnlike > best) {
+					best=lnlike;
+					improved=1;
+				} else p[d]=old;
+			}
+		}
+		if (!improved) step*=0.5;
+	}
+
+	this->ell.resize(ndim);
+	for (int d=0; d<ndim; d++) this->ell[d]=exp(p[d]);
+	this->nugget=exp(p[ndim]);
+	if (factor(this->ell.data(),this->nugget) == -INFINITY) {
+		printf("The emulator's correlation matrix is singular (repeated training points?)\n");
+		exit(1);
+	}
+}
+
+
+void Emulator::predict(const double *u, double *mean, double *sd)
+// the mean and standard deviation of each output at u
+{
+	int n=this->ntrain;
+	std::vector<double> k(n), v(n);
+	for (int m=0; m<n; m++) k[m]=correlation(u,&this->u[m*this->ndim],this->ell.data());
+	// v = L^-1 k, so that k^T K^-1 k = v^T v
+	double kk=0.0;
+	for (int i=0; i<n; i++) {
+		double s=k[i];
+		for (int m=0; m<i; m++) s-=this->L[i*n+m]*v[m];
+		v[i]=s/this->L[i*n+i];
+		kk+=v[i]*v[i];
+	}
+	double c=1.0+this->nugget-kk;
+	if (c < 0.0) c=0.0;
+	for (int j=0; j<this->nout; j++) {
+		double m=this->mu[j];
+		for (int i=0; i<n; i++) m+=k[i]*this->alpha[j*n+i];
+		mean[j]=m;
+		sd[j]=sqrt(this->var[j]*c);
+	}
+}
+
+
+double Emulator::chisq(Data &data, const double *u, double *sd)
+// the emulated chisq at u, and its standard deviation
+{
+	std::vector<double> mean(this->nout), s(this->nout);
+	predict(u,mean.data(),s.data());
+	double chisq=0.0, var=0.0;
+	for (int j=0; j<this->nout; j++) {
+		double r=(data.TT[j+1]-mean[j])/data.Te[j+1];
+		double sj=s[j]/data.Te[j+1];
+		chisq+=r*r;
+		var+=4.0*r*r*sj*sj+2.0*sj*sj*sj*sj;
+	}
+	*sd=sqrt(var);
+	return chisq;
+}
+
+
+void Emulator::save(const char *fname)
+{
+	FILE *fp = fopen(fname,"w");
+	if (fp == NULL) {
+		printf("Could not open %s\n", fname);
+		exit(1);
+	}
+	fprintf(fp,"# crustcool emulator\n%d %d %d\n", this->ndim, this->nout, this->ntrain);
+	for (int d=0; d<this->ndim; d++) {
+		Prior &p=this->priors[d];
+		fprintf(fp,"%s %.17g %.17g %d\n", p.name, p.min, p.max, p.log);
+	}
+	for (int d=0; d<this->ndim; d++) fprintf(fp,"%.17g ",this->ell[d]);
+	fprintf(fp,"%.17g\n",this->nugget);
+	for (int k=0; k<this->ntrain; k++) {
+		for (int d=0; d<this->ndim; d++) fprintf(fp,"%.17g ",this->u[k*this->ndim+d]);
+		for (int j=0; j<this->nout; j++) fprintf(fp," %.17g",this->y[k*this->nout+j]);
+		fprintf(fp,"\n");
+	}
+	fclose(fp);
+}
+
+
+int Emulator::load(const char *fname)
+// reads an emulator written by save and factors it; returns 0 if it can't be read
+{
+	FILE *fp = fopen(fname,"r");
+	if (fp == NULL) {
+		printf("Could not open %s\n", fname);
+		return 0;
+	}
+	char s[200];
+	int ntrain, ok=1;
+	if (fgets(s,200,fp) == NULL || fscanf(fp,"%d %d %d",&this->ndim,&this->nout,&ntrain) != 3) ok=0;
+	this->priors.resize(ok ? this->ndim : 0);
+	for (int d=0; ok && d<this->ndim; d++) {
+		Prior &p=this->priors[d];
+		if (fscanf(fp,"%63s %lg %lg %d",p.name,&p.min,&p.max,&p.log) != 4) ok=0;
+	}
+	this->ell.resize(ok ? this->ndim : 0);
+	for (int d=0; ok && d<this->ndim; d++) if (fscanf(fp,"%lg",&this->ell[d]) != 1) ok=0;
+	if (ok && fscanf(fp,"%lg",&this->nugget) != 1) ok=0;
+	this->ntrain=0;
+	this->u.clear();
+	this->y.clear();
+	std::vector<double> uk(this->ndim), yk(this->nout);
+	for (int k=0; ok && k<ntrain; k++) {
+		for (int d=0; d<this->ndim; d++) if (fscanf(fp,"%lg",&uk[d]) != 1) ok=0;
+		for (int j=0; j<this->nout; j++) if (fscanf(fp,"%lg",&yk[j]) != 1) ok=0;
+		if (ok) add(uk.data(),yk.data());
+	}
+	fclose(fp);
+	if (!ok) {
+		printf("%s is not an emulator file\n", fname);
+		return 0;
+	}
+	if (factor(this->ell.data(),this->nugget) == -INFINITY) {
+		printf("The correlation matrix of the emulator in %s is singular\n", fname);
+		return 0;
+	}
+	return 1;
+}
+
+
+void run_emulate(Run &base, const char *fname, int nthreads, int ntrain, unsigned long seed)
+{
+	// results go to stdout, so move everything else to stderr
+	fflush(stdout);
+	FILE *out = fdopen(dup(1),"w");
+	dup2(2,1);
+
+	// the training runs are all full models
+	base.emulator[0]='\0';
+	Sampler sampler(base,nthreads);
+	int ndim=sampler.ndim, nout=base.data.n;
+	if (ntrain <= 0) ntrain=20*ndim;
+
+	std::vector<double> u(ntrain*ndim), x(ntrain*ndim), lnp(ntrain), r(ntrain*nout);
+	latin_hypercube(ntrain,sampler.priors,seed,u.data(),x.data());
+
+	double start=wall_time();
+	fprintf(out,"Running %d models over %d parameters\n", ntrain, ndim);
+	fflush(out);
+	sampler.evaluate(ntrain,x.data(),lnp.data(),0,r.data());
+	double trun=wall_time()-start;
+
+	// the outputs are the model at the data points, data - error*residual
+	Emulator emu;
+	emu.ndim=ndim;
+	emu.nout=nout;
+	emu.priors=sampler.priors;
+	std::vector<double> y(nout);
+	for (int k=0; k<ntrain; k++) {
+		if (lnp[k] == -INFINITY) continue;
+		for (int j=0; j<nout; j++) y[j]=base.data.TT[j+1]-base.data.Te[j+1]*r[k*nout+j];
+		emu.add(&u[k*ndim],y.data());
+	}
+	if (emu.ntrain < ntrain) fprintf(out,"%d of the models failed\n", ntrain-emu.ntrain);
+	emu.train();
+	emu.save(fname);
+
+	fprintf(out,"Trained on %d models (%lg s) in %lg s; correlation lengths:", emu.ntrain, trun,
+		wall_time()-start-trun);
+	for (int d=0; d<ndim; d++) fprintf(out," %s %.3g",sampler.priors[d].name,emu.ell[d]);
+	fprintf(out,", nugget %.3g\n",emu.nugget);
+	fclose(out);
+}
@@ -0,0 +1,404 @@
+// class Ensemble
+//
+// Evolves nmodels crusts with the same grid together (see h/ensemble.h).
+// Each model has its own Qimp, Qinner, Tc, Tt and mdot; everything else, including
+// toutburst and timetorun, comes from the base Run, which must have been set up
+// and must not be set up again while the Ensemble exists.
+//
+// All the models are integrated with the same time steps, using the two-stage
+// Rosenbrock method ROS2 (Verwer et al. 1999, SIAM J. Sci. Comput. 20, 1456),
+// which is L-stable and stays second order with an approximate Jacobian.
+// The Jacobian is tridiagonal, so it is found with three evaluations of the
+// derivatives for all the models (perturbing every third cell at a time), and
+// the linear systems are solved with the Thomas algorithm, with the loop over
+// models innermost. The step is controlled by the largest error of any model.
+//
+// The results agree with Crust::evolve to within the accuracy eps (default 1e-4
+// in the temperature, which is well below the errors in the data).
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include "../h/ensemble.h"
+#include "../h/timer.h"
+#include "../h/fail.h"
+
+Ensemble::Ensemble(Run &base, int nmodels) : base(base), crust(base.crust)
+{
+	if (base.needs_setup) base.setup();
+	this->nmodels=nmodels;
+	this->K=nmodels;
+	this->N=this->crust.N;
+	this->eps=1e-4;
+	this->nsteps=0;
+
+	this->Qimp = new double [nmodels];
+	this->Qinner = new double [nmodels];
+	this->Tc = new double [nmodels];
+	this->Tt = new double [nmodels];
+	this->mdot = new double [nmodels];
+	this->chisq = new double [nmodels];
+	for (int m=0; m<nmodels; m++) {
+		this->Qimp[m]=this->crust.Qimp;
+		this->Qinner[m]=this->crust.Qinner;
+		this->Tc[m]=this->crust.Tc;
+		this->Tt[m]=this->crust.Tt;
+		this->mdot[m]=this->crust.mdot;
+		this->chisq[m]=0.0;
+	}
+
+	int n=(this->N+2)*nmodels;
+	double **arrays[] = { &this->T, &this->f0, &this->f1, &this->k1, &this->k2, &this->Y, &this->work,
+		&this->Kc, &this->CP, &this->NU, &this->F, &this->a, &this->b, &this->c, &this->cp, &this->dinv, NULL };
+	for (int k=0; arrays[k] != NULL; k++) {
+		*arrays[k] = new double [n];
+		for (int i=0; i<n; i++) (*arrays[k])[i]=0.0;
+	}
+	this->eps0 = new double [this->N+2];
+	this->fac = new double [this->N+2];
+	this->eps_scale = new double [nmodels];
+	this->Qin = new double [nmodels];
+	this->heating = new int [nmodels];
+	this->cooling_bc = new int [nmodels];
+}
+
+Ensemble::~Ensemble()
+{
+	delete [] this->Qimp; delete [] this->Qinner; delete [] this->Tc; delete [] this->Tt;
+	delete [] this->mdot; delete [] this->chisq;
+	delete [] this->T; delete [] this->f0; delete [] this->f1; delete [] this->k1;
+	delete [] this->k2; delete [] this->Y; delete [] this->work;
+	delete [] this->Kc; delete [] this->CP; delete [] this->NU; delete [] this->F;
+	delete [] this->a; delete [] this->b; delete [] this->c; delete [] this->cp; delete [] this->dinv;
+	delete [] this->eps0; delete [] this->fac; delete [] this->eps_scale; delete [] this->Qin;
+	delete [] this->heating; delete [] this->cooling_bc;
+}
+
+
+void Ensemble::run(void)
+// runs the outburst and the cooling for every model and calculates chi-squared
+{
+	int K=this->K;
+	Crust &crust=this->crust;
+	if (this->base.use_piecewise || crust.resume) {
+		fail("Ensemble runs start from the core temperature: piecewise and resume are not supported");
+	}
+
+	// this uses the base run's crust, so its next run has to start again
+	this->base.invalidate(STAGE_HEATING);
+	crust.reset();
+	for (int m=0; m<K; m++) {
+		if (this->Qinner[m] == -1.0) this->Qin[m]=this->Qimp[m]; else this->Qin[m]=this->Qinner[m];
+		for (int i=0; i<=this->N+1; i++) this->T[i*K+m]=this->Tc[m];
+	}
+	this->tsave.clear();
+	this->Tsave.clear();
+	this->nsteps=0;
+
+	// geometric factor in dT/dt
+	for (int i=1; i<=this->N; i++)
+		this->fac[i]=crust.g*pow(crust.grid[0].r/crust.grid[i].r,4.0)/(crust.dx*crust.grid[i].P);
+
+	// the same times as Run::run, converted as in Crust::evolve: toutburst in
+	// years and timetorun in days, at infinity
+	int cooling = this->base.time_to_run > 0.0;
+	evolve(crust.outburst_duration*3.15e7/crust.ZZ,1,!cooling);
+	if (cooling) evolve(this->base.time_to_run/(365.0*crust.ZZ)*3.15e7,0,1);
+
+	// chi-squared for each model
+	double *time = new double [this->nsteps+1];
+	double *Ttop = new double [this->nsteps+1];
+	for (int m=0; m<K; m++) {
+		for (int k=0; k<this->nsteps; k++) {
+			time[k+1]=this->tsave[k];
+			Ttop[k+1]=this->Tsave[k*K+m];
+		}
+		this->chisq[m]=this->base.data.calculate_chisq(crust,this->nsteps,time,Ttop);
+	}
+	delete [] time;
+	delete [] Ttop;
+}
+
+
+void Ensemble::evolve(double duration, int heating, int record)
+// integrates all the models for duration seconds (star frame); the top
+// temperatures are saved after every step if record is set
+{
+	Crust &crust=this->crust;
+	int K=this->K, N=this->N;
+
+	// the heating table is made for mdot=1 and scaled for each model
+	double mdot_save=crust.mdot, duration_save=crust.outburst_duration;
+	int heating_save=crust.heating;
+	crust.outburst_duration=duration/3.15e7;
+	crust.mdot=1.0;
+	crust.heating=heating;
+	crust.precalculate_vars();
+	int magnetar = crust.outburst_duration < 1.0/365.0;
+	for (int i=1; i<=N+1; i++) this->eps0[i]=crust.EPS_grid[i][1]*crust.g;
+	for (int m=0; m<K; m++) {
+		// as in Crust::evolve, a model with mdot=0 isn't heating during the outburst
+		this->heating[m] = heating && this->mdot[m] > 0.0;
+		this->cooling_bc[m] = !(this->heating[m] && crust.outburst_duration > 1.0/365.0 && !crust.force_cooling_bc);
+		if (!this->heating[m]) this->eps_scale[m]=0.0;
+		else if (magnetar) this->eps_scale[m]=1.0;    // energy per unit volume is fixed
+		else this->eps_scale[m]=this->mdot[m];
+	}
+
+	// ROS2
+	const double gamma=1.0+1.0/sqrt(2.0);
+	int n=(N+2)*K;
+	double t=0.0, h=1e-6*duration;
+	if (record) save(t);
+	int nstep=0;
+	while (t < duration) {
+		if (t+h > duration) h=duration-t;
+		derivs(this->T,this->f0);
+		jacobian(this->T,this->f0);
+		while (1) {
+			factor(gamma*h);
+			solve(this->f0,this->k1);
+			for (int k=K; k<n; k++) this->Y[k]=this->T[k]+h*this->k1[k];
+			derivs(this->Y,this->f1);
+			for (int k=K; k<n; k++) this->work[k]=this->f1[k]-2.0*this->k1[k];
+			solve(this->work,this->k2);
+
+			double err=0.0;
+			for (int k=K; k<n; k++) {
+				this->Y[k]=this->T[k]+h*(1.5*this->k1[k]+0.5*this->k2[k]);
+				double e = 0.5*h*(this->k1[k]+this->k2[k]);    // difference from the first order solution
+				double scale = 1e3 + this->eps*fmax(fabs(this->T[k]),fabs(this->Y[k]));
+				err=fmax(err,fabs(e)/scale);
+			}
+			if (isnan(err) || isnan(this->Y[K])) err=1e10;
+			if (err <= 1.0) {
+				t+=h;
+				for (int k=K; k<n; k++) this->T[k]=this->Y[k];
+				h*=fmin(5.0,0.9/sqrt(fmax(err,1e-10)));
+				break;
+			}
+			h*=fmax(0.2,0.9/sqrt(err));
+			if (h < 1e-12*duration) {
+				fail("Ensemble: step size too small at t=%lg", t);
+			}
+		}
+		if (record) save(t);
+		nstep++;
+	}
+	printf("Ensemble of %d models: %d steps for %lg s\n", K, nstep, duration);
+
+	crust.mdot=mdot_save;
+	crust.outburst_duration=duration_save;
+	crust.heating=heating_save;
+}
+
+
+void Ensemble::derivs(double *T, double *dTdt)
+// dT/dt for every cell and model, as in Crust::derivs and Crust::calculate_vars
+{
+	Crust &crust=this->crust;
+	int K=this->K, N=this->N;
+
+	// the field only changes the conductivity by a constant factor
+	double Bfac=1.0;
+	if (crust.EOS->B > 0.0) {
+		double mu=crust.angle_mu;
+		if (mu >= 0.0) Bfac=4.0*mu*mu/(1.0+3.0*mu*mu);
+		else Bfac=0.5*1.0544;
+	}
+
+	for (int i=1; i<=N+1; i++) {
+		double *K0g=crust.K0_grid[i], *K1g=crust.K1_grid[i], *KAg=crust.KAPPA_grid[i];
+		double *CPg=crust.CP_grid[i], *NUg=crust.NU_grid[i];
+		int inner = crust.grid[i].rho > crust.Qrho;
+		double Qcell = crust.grid[i].Qimpur;
+		for (int m=0; m<K; m++) {
+			double Tm=T[i*K+m];
+			if (isnan(Tm) || Tm<0.0) Tm=1e7;
+			double beta=log10(Tm);
+			if (beta > crust.betamax) beta = crust.betamax;
+			if (beta < crust.betamin) beta = crust.betamin;
+			int j = 1 + (int) ((beta-crust.betamin)/crust.deltabeta);
+			if (j > crust.nbeta-1) j=crust.nbeta-1;
+			double w=(beta-(crust.betamin + (j-1)*crust.deltabeta))/crust.deltabeta;
+
+			double K0=K0g[j] + (K0g[j+1]-K0g[j])*w;
+			double K1=K1g[j] + (K1g[j+1]-K1g[j])*w;
+			double Q;
+			if (crust.hardwireQ) Q = inner ? this->Qin[m] : this->Qimp[m];
+			else Q = Qcell;
+			double KK=crust.g*K0*K1/(K0*Q+(1.0-Q)*K1) + crust.g*(KAg[j] + (KAg[j+1]-KAg[j])*w);
+			this->Kc[i*K+m]=KK*Bfac;
+			this->CP[i*K+m]=CPg[j] + (CPg[j+1]-CPg[j])*w;
+			if (crust.nuflag) this->NU[i*K+m]=NUg[j] + (NUg[j+1]-NUg[j])*w;
+			else this->NU[i*K+m]=0.0;
+		}
+	}
+
+	// outer boundary
+	for (int m=0; m<K; m++) {
+		if (this->heating[m] && this->Tt[m]>0.0 && !crust.force_cooling_bc) T[m]=this->Tt[m];
+		else T[m]=T[K+m]*(8.0-crust.dx)/(8.0+crust.dx);
+		this->Kc[m]=this->Kc[K+m];
+	}
+
+	// fluxes; F[i] is at i-1/2
+	for (int m=0; m<K; m++) {
+		if (this->cooling_bc[m]) this->F[K+m]=crust.surface_flux(T[K+m],NULL);
+		else this->F[K+m]=0.5*(this->Kc[K+m]+this->Kc[m])*(T[K+m]-T[m])/crust.dx;
+	}
+	for (int i=2; i<=N; i++)
+		for (int m=0; m<K; m++)
+			this->F[i*K+m]=0.5*(this->Kc[i*K+m]+this->Kc[(i-1)*K+m])*(T[i*K+m]-T[(i-1)*K+m])/crust.dx;
+	for (int m=0; m<K; m++)
+		this->F[(N+1)*K+m]=this->Kc[N*K+m]*(T[(N+1)*K+m]-T[N*K+m])/crust.dx;
+
+	for (int i=1; i<=N; i++) {
+		for (int m=0; m<K; m++) {
+			int k=i*K+m;
+			dTdt[k]=(this->fac[i]*(this->F[k+K]-this->F[k]) - this->NU[k] + this->eps0[i]*this->eps_scale[m])/this->CP[k];
+		}
+	}
+	// the cell at N+1 represents the core
+	double area=4.0*M_PI*pow(1e5*crust.radius,2.0);
+	for (int m=0; m<K; m++) {
+		int k=(N+1)*K+m;
+		dTdt[k]=(-this->F[k]*area - this->NU[k])/this->CP[k];
+	}
+}
+
+
+void Ensemble::jacobian(double *T, double *f)
+// the tridiagonal Jacobian: a is d(dT_i/dt)/dT_{i-1}, b is d/dT_i, c is d/dT_{i+1}.
+// Perturbing every third cell at once gives three columns per cell with three
+// evaluations of the derivatives.
+{
+	int K=this->K, N=this->N, n=(N+2)*K;
+	double e=0.01;
+	for (int colour=0; colour<3; colour++) {
+		for (int k=0; k<n; k++) this->Y[k]=T[k];
+		for (int i=1+colour; i<=N+1; i+=3)
+			for (int m=0; m<K; m++) this->Y[i*K+m]*=1.0+e;
+		derivs(this->Y,this->f1);
+		for (int i=1+colour; i<=N+1; i+=3) {
+			for (int m=0; m<K; m++) {
+				int k=i*K+m;
+				double dT=T[k]*e;
+				if (i > 1) this->c[k-K]=(this->f1[k-K]-f[k-K])/dT;
+				this->b[k]=(this->f1[k]-f[k])/dT;
+				if (i < N+1) this->a[k+K]=(this->f1[k+K]-f[k+K])/dT;
+			}
+		}
+	}
+}
+
+
+void Ensemble::factor(double gh)
+// LU decomposition of the tridiagonal matrices I - gh*J
+{
+	int K=this->K, N=this->N;
+	this->gh=gh;
+	for (int m=0; m<K; m++) {
+		int k=K+m;
+		this->dinv[k]=1.0/(1.0-gh*this->b[k]);
+		this->cp[k]=-gh*this->c[k]*this->dinv[k];
+	}
+	for (int i=2; i<=N+1; i++) {
+		for (int m=0; m<K; m++) {
+			int k=i*K+m;
+			double sup = (i < N+1) ? -gh*this->c[k] : 0.0;
+			this->dinv[k]=1.0/(1.0-gh*this->b[k] + gh*this->a[k]*this->cp[k-K]);
+			this->cp[k]=sup*this->dinv[k];
+		}
+	}
+}
+
+
+void Ensemble::solve(double *r, double *x)
+// solves (I - gh*J) x = r using the decomposition from factor
+{
+	int K=this->K, N=this->N;
+	for (int m=0; m<K; m++) x[K+m]=r[K+m]*this->dinv[K+m];
+	for (int i=2; i<=N+1; i++)
+		for (int m=0; m<K; m++) {
+			int k=i*K+m;
+			x[k]=(r[k] + this->gh*this->a[k]*x[k-K])*this->dinv[k];
+		}
+	for (int i=N; i>=1; i--)
+		for (int m=0; m<K; m++) {
+			int k=i*K+m;
+			x[k]-=this->cp[k]*x[k+K];
+		}
+}
+
+
+void Ensemble::save(double t)
+{
+	this->tsave.push_back(t);
+	for (int m=0; m<this->K; m++) this->Tsave.push_back(this->T[this->K+m]);
+	this->nsteps++;
+}
+
+
+void run_ensemble(Run &base, const char *fname)
+{
+	FILE *fp = fopen(fname,"r");
+	if (fp == NULL) {
+		printf("Could not open %s\n", fname);
+		exit(1);
+	}
+	std::vector<std::string> models;
+	std::vector<int> lines;
+	char s[1000];
+	int line=0;
+	while (fgets(s,1000,fp) != NULL) {
+		line++;
+		char key[200];
+		if (sscanf(s,"%199s",key) != 1 || key[0] == '#') continue;
+		models.push_back(s);
+		lines.push_back(line);
+	}
+	fclose(fp);
+
+	// results go to stdout, so move everything else to stderr
+	fflush(stdout);
+	FILE *out = fdopen(dup(1),"w");
+	dup2(2,1);
+
+	base.output_heating=0;
+	base.output_cooling=0;
+	base.crust.output=0;
+	base.setup();
+
+	Ensemble ens(base,(int) models.size());
+	for (int m=0; m<ens.nmodels; m++) {
+		char text[1000], *save;
+		strcpy(text,models[m].c_str());
+		char *key = strtok_r(text," \t\n",&save);
+		while (key != NULL) {
+			char *value = strtok_r(NULL," \t\n",&save);
+			double *p=NULL;
+			if (!strcmp(key,"Qimp")) p=ens.Qimp;
+			else if (!strcmp(key,"Qinner")) p=ens.Qinner;
+			else if (!strcmp(key,"Tc")) p=ens.Tc;
+			else if (!strcmp(key,"Tt")) p=ens.Tt;
+			else if (!strcmp(key,"mdot")) p=ens.mdot;
+			if (p == NULL || value == NULL) {
+				printf("Line %d: %s can't be varied in an ensemble (only Qimp, Qinner, Tc, Tt and mdot)\n", lines[m], key);
+				exit(1);
+			}
+			p[m]=atof(value);
+			key = strtok_r(NULL," \t\n",&save);
+		}
+	}
+
+	double start=wall_time();
+	ens.run();
+	printf("Finished %d models in %lg s\n", ens.nmodels, wall_time()-start);
+	for (int m=0; m<ens.nmodels; m++) fprintf(out,"%d %.10g\n",lines[m],ens.chisq[m]);
+	fclose(out);
+}
@@ -2,14 +2,9 @@
 #include "math.h"
 #include <stdlib.h>
 
-void* pt2EnvObject;
-
 Envelope::Envelope()
 {	
-	pt2EnvObject=(void*) this;
-  	
-	static Eos myeos(1);
-    this->EOS = &myeos;
+	this->EOS = new Eos(1);
 	this->EOS->X[1]=1.0;
 	this->EOS->Qimp=1.0;
 	this->EOS->accr=1;	
@@ -25,6 +20,7 @@ Envelope::Envelope()
 		
 	// Default values
 	this->g = 2.28e14;
+	this->ybase = 18.5;
 	
 }
 
@@ -33,6 +29,7 @@ Envelope::~Envelope()
 {
 	this->ODE.tidy();
 	this->ODE2.tidy();
+	delete this->EOS;
 }
 
 
@@ -45,10 +42,19 @@ void Envelope::make_grid(double yi, double B)
 	this->Bfield = B;
 	this->EOS->B=this->Bfield;
 
+	// output the ocean every 0.1 in log10 column
+	double xout[200];
+	int nout=0;
+	double ystart = (yi == 0.0) ? 8.0 : yi;
+	while (ystart+0.1*(nout+1) < this->ybase && nout < 200) {
+		xout[nout]=ystart+0.1*(nout+1);
+		nout++;
+	}
+
 	for (int i=0; i<=90; i++) {
 		double flux=17.0+i*0.1;
 		this->F=pow(10.0,flux);
-		this->doint();
+		if (!this->doint(nout,xout)) continue;
 		printf("."); fflush(stdout);
      	//for (int j=1; j<=ODE2.kount; j++) {
 		//	fprintf(this->fp, "%lg %lg %lg %lg\n", this->ODE2.get_x(j), log10(this->ODE2.get_y(1,j)), flux, this->yt);
@@ -63,8 +69,55 @@ void Envelope::make_grid(double yi, double B)
 }
 
 
-void Envelope::doint(void)
+int Envelope::solve(double yi, double B, double F, int ny, double *lgy, double *lgT)
+// yi is the log10 of the base column of the He layer
+// B is the magnetic field strength
+// returns 0 (and lgT all NAN) if there is no solution for this flux
+{
+	this->yi = yi;
+	this->Bfield = B;
+	this->EOS->B=this->Bfield;
+	this->F = F;
+
+	// only integrate as deep as the deepest point asked for
+	double ybase_store = this->ybase;
+	this->ybase = lgy[0];
+	for (int k=1; k<ny; k++) if (lgy[k] > this->ybase) this->ybase = lgy[k];
+	int ok=this->doint(ny,lgy);
+	this->ybase = ybase_store;
+	if (!ok) {
+		for (int k=0; k<ny; k++) lgT[k]=NAN;
+		return 0;
+	}
+
+	for (int k=0; k<ny; k++) {
+		// the light element layer is in ODE2, the ocean in ODE
+		if (!interpolate_profile(&this->ODE2,lgy[k],&lgT[k]))
+			if (!interpolate_profile(&this->ODE,lgy[k],&lgT[k])) lgT[k]=NAN;
+	}
+	return 1;
+}
+
+
+int Envelope::interpolate_profile(Ode_Int *ode, double x, double *lgT)
+// linearly interpolates log10 T at log10 column x from the last integration
+// returns 0 if x is outside the integrated range
+{
+	if (ode->kount < 2 || x < ode->get_x(1) || x > ode->get_x(ode->kount)) return 0;
+	int j=2;
+	while (j < ode->kount && ode->get_x(j) < x) j++;
+	double x1=ode->get_x(j-1), x2=ode->get_x(j);
+	double T1=log10(ode->get_y(1,j-1)), T2=log10(ode->get_y(1,j));
+	*lgT = T1 + (T2-T1)*(x-x1)/(x2-x1);
+	return 1;
+}
+
+
+int Envelope::doint(int nout, double *xout)
 // for the specified flux, integrate inwards to see if we match the base temperature
+// the profile is stored at the log10 column depths xout (in increasing order), 
+// and at the top and base of each layer
+// returns 0 if the photosphere lies beneath the light element layer
 {
   	// we do this in two steps: light element layer first
 	this->EOS->use_potek_eos = use_potek_eos_in_He;
@@ -80,18 +133,18 @@ void Envelope::doint(void)
 	}
   	// set surface temperature. We integrate from tau=2/3
 	double y1=1e-3,y2=1e8;
-	this->yt=zbrent(this->Wrapper_find_surf_eqn,y1,y2,1e-6);
+	this->yt=zbrent(this->Wrapper_find_surf_eqn,this,y1,y2,1e-6);
   	if (this->yt==y1 || this->yt==y2) printf("yt out of bounds (%lg)\n", this->yt);
 	if (this->yt > pow(10.0,yi)) {
-		printf("The photosphere lies beneath the helium column! Increase yi and try again.\n");
-		exit(0);
+		printf("The photosphere lies beneath the helium column for F=%lg (increase yi)\n", this->F);
+		return 0;
 	}
 
   	double Tt=pow(this->F/5.67e-5,0.25);
 	this->ODE2.set_bc(1,Tt);
 
-  	// integrate
-  	this->ODE2.go_simple(log10(this->yt),yi,(int)((yi-log10(this->yt))/0.1));
+  	// integrate (no further than the base of the ocean integration)
+  	this->ODE2.go_scalar(log10(this->yt),(this->ybase < yi) ? this->ybase : yi,1e-6,nout,xout);
 
   	// keep the base temperature for the next integration
   	double base_T=this->ODE2.get_y(1,this->ODE2.kount);
@@ -103,17 +156,19 @@ void Envelope::doint(void)
  	this->EOS->A[1]=56.0; this->EOS->Z[1]=26.0;  // Iron
   
   	// integrate through the ocean to the desired depth 
-	this->ODE.go_simple(yi,18.5,(int)((18.5-yi)/0.1));
+	if (this->ybase > yi) this->ODE.go_scalar(yi,this->ybase,1e-6,nout,xout);
+	else this->ODE.kount=0;
 	
 	// reset EOS for next time
 	this->EOS->Yn=0.0; this->EOS->set_Ye=0.0; 
+	return 1;
 }
 
 
 
-double Envelope::Wrapper_find_surf_eqn(double y)
+double Envelope::Wrapper_find_surf_eqn(double y, void *p)
 {
-  Envelope* mySelf = (Envelope*) pt2EnvObject;
+  Envelope* mySelf = (Envelope*) p;
   return mySelf->find_surf_eqn(y);
 }
 
@@ -0,0 +1,182 @@
+// class EnvelopeLibrary
+//
+// Storage for the binary envelope library written by 'makegrid' in batch mode.
+// The file is
+//     "ENVLIB1" (8 bytes), then nyi, nB, ng, nF, ny (ints),
+//     the axes yi[nyi], B[nB], g[ng], lgF[nF], lgy[ny] (doubles),
+//     then log10 T for every model, with the column depth index varying
+//     fastest and the light element column slowest.
+// Points above the photosphere of a model are stored as NAN.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include "math.h"
+#include "../h/envlib.h"
+
+// definitions for fread & fwrite
+#define DSIZE sizeof(double)
+#define ISIZE sizeof(int)
+
+EnvelopeLibrary::EnvelopeLibrary()
+{
+	this->nyi=0; this->nB=0; this->ng=0; this->nF=0; this->ny=0;
+	this->yi=NULL; this->B=NULL; this->g=NULL; this->lgF=NULL; this->lgy=NULL;
+	this->lgT=NULL;
+	this->owns_data=0;
+}
+
+EnvelopeLibrary::~EnvelopeLibrary()
+{
+	delete [] this->yi;
+	delete [] this->B;
+	delete [] this->g;
+	delete [] this->lgF;
+	delete [] this->lgy;
+	if (this->owns_data) delete [] this->lgT;
+}
+
+void EnvelopeLibrary::allocate(int nyi, int nB, int ng, int nF, int ny, double *data)
+// sets up storage for the axes and the models. If data is non-NULL, it is used
+// to hold the models (e.g. a block of memory shared between worker processes)
+{
+	this->nyi=nyi; this->nB=nB; this->ng=ng; this->nF=nF; this->ny=ny;
+	this->yi = new double [nyi];
+	this->B = new double [nB];
+	this->g = new double [ng];
+	this->lgF = new double [nF];
+	this->lgy = new double [ny];
+	if (data == NULL) {
+		this->lgT = new double [size()];
+		this->owns_data=1;
+	} else {
+		this->lgT = data;
+		this->owns_data=0;
+	}
+}
+
+size_t EnvelopeLibrary::size(void)
+// total number of stored temperatures
+{
+	return (size_t) this->nyi*this->nB*this->ng*this->nF*this->ny;
+}
+
+size_t EnvelopeLibrary::index(int iyi, int iB, int ig, int iF)
+// index of the model, counting from 0
+{
+	return (((size_t) iyi*this->nB + iB)*this->ng + ig)*this->nF + iF;
+}
+
+double *EnvelopeLibrary::profile(int iyi, int iB, int ig, int iF)
+// pointer to the ny values of log10 T for this model
+{
+	return this->lgT + index(iyi,iB,ig,iF)*this->ny;
+}
+
+void EnvelopeLibrary::write(const char *fname)
+{
+	FILE *fp = fopen(fname,"wb");
+	if (fp == NULL) {
+		printf("Could not open %s to write the envelope library\n", fname);
+		return;
+	}
+	char magic[8]="ENVLIB1";
+	fwrite(magic,1,8,fp);
+	fwrite(&this->nyi,ISIZE,1,fp);
+	fwrite(&this->nB,ISIZE,1,fp);
+	fwrite(&this->ng,ISIZE,1,fp);
+	fwrite(&this->nF,ISIZE,1,fp);
+	fwrite(&this->ny,ISIZE,1,fp);
+	fwrite(this->yi,DSIZE,this->nyi,fp);
+	fwrite(this->B,DSIZE,this->nB,fp);
+	fwrite(this->g,DSIZE,this->ng,fp);
+	fwrite(this->lgF,DSIZE,this->nF,fp);
+	fwrite(this->lgy,DSIZE,this->ny,fp);
+	fwrite(this->lgT,DSIZE,size(),fp);
+	fclose(fp);
+}
+
+int EnvelopeLibrary::read(const char *fname)
+// returns 1 if the library was read successfully, 0 otherwise
+{
+	FILE *fp = fopen(fname,"rb");
+	if (fp == NULL) return 0;
+
+	char magic[8];
+	int n[5];
+	if (fread(magic,1,8,fp) != 8 || strncmp(magic,"ENVLIB1",7) || fread(n,ISIZE,5,fp) != 5) {
+		printf("%s is not an envelope library\n", fname);
+		fclose(fp);
+		return 0;
+	}
+	allocate(n[0],n[1],n[2],n[3],n[4],NULL);
+	size_t count = fread(this->yi,DSIZE,this->nyi,fp);
+	count += fread(this->B,DSIZE,this->nB,fp);
+	count += fread(this->g,DSIZE,this->ng,fp);
+	count += fread(this->lgF,DSIZE,this->nF,fp);
+	count += fread(this->lgy,DSIZE,this->ny,fp);
+	count += fread(this->lgT,DSIZE,size(),fp);
+	fclose(fp);
+
+	if (count != (size_t) (this->nyi+this->nB+this->ng+this->nF+this->ny)+size()) {
+		printf("Envelope library %s is truncated\n", fname);
+		return 0;
+	}
+	printf("Read envelope library %s: %d yi x %d B x %d g x %d fluxes x %d depths\n",
+		fname, this->nyi, this->nB, this->ng, this->nF, this->ny);
+	return 1;
+}
+
+int EnvelopeLibrary::bracket(double *axis, int n, double x, int log_axis, int *i, double *w)
+// finds the axis values either side of x, returning their indices in i[0],i[1]
+// and the interpolation weight w of i[1]. Interpolation is in log10 of the axis
+// value if log_axis is set, except between zero and the smallest nonzero value.
+// Returns 0 if x is outside the range of the axis.
+{
+	i[0]=-1; i[1]=-1;
+	for (int k=0; k<n; k++) {
+		if (axis[k] <= x && (i[0] < 0 || axis[k] > axis[i[0]])) i[0]=k;
+		if (axis[k] >= x && (i[1] < 0 || axis[k] < axis[i[1]])) i[1]=k;
+	}
+	if (i[0] < 0 || i[1] < 0) {
+		// allow for round-off when the axis has a single value
+		if (n == 1 && fabs(x-axis[0]) <= 1e-6*fabs(axis[0])) {
+			i[0]=0; i[1]=0; *w=0.0;
+			return 1;
+		}
+		return 0;
+	}
+	double x1=axis[i[0]], x2=axis[i[1]];
+	if (x2 == x1) *w=0.0;
+	else if (log_axis && x1 > 0.0) *w=log10(x/x1)/log10(x2/x1);
+	else *w=(x-x1)/(x2-x1);
+	return 1;
+}
+
+int EnvelopeLibrary::relation(double yi, double B, double g, double lgy0, double *lgTb)
+// multilinear interpolation in (yi, log B, log g) between the 8 surrounding models,
+// each of which is interpolated linearly in log column depth to lgy0
+{
+	int iyi[2], iB[2], ig[2];
+	double wyi, wB, wg;
+	if (!bracket(this->yi,this->nyi,yi,0,iyi,&wyi) || !bracket(this->B,this->nB,B,1,iB,&wB)
+		|| !bracket(this->g,this->ng,g,1,ig,&wg)) return 0;
+
+	// column depth
+	if (lgy0 < this->lgy[0] || lgy0 > this->lgy[this->ny-1]) return 0;
+	int k=0;
+	while (k < this->ny-2 && this->lgy[k+1] < lgy0) k++;
+	double wy = (lgy0-this->lgy[k])/(this->lgy[k+1]-this->lgy[k]);
+
+	for (int iF=0; iF<this->nF; iF++) {
+		lgTb[iF]=0.0;
+		for (int c=0; c<8; c++) {
+			int a=c&1, b=(c>>1)&1, d=(c>>2)&1;
+			double w = (a ? wyi : 1.0-wyi) * (b ? wB : 1.0-wB) * (d ? wg : 1.0-wg);
+			if (w == 0.0) continue;
+			double *T = profile(iyi[a],iB[b],ig[d],iF);
+			lgTb[iF] += w*(T[k] + (T[k+1]-T[k])*wy);    // NAN propagates if above the photosphere
+		}
+	}
+	return 1;
+}
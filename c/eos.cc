@@ -7,11 +7,14 @@
 #include "../h/root.h"
 #include "../h/odeint.h"
 #include "../h/eos.h"
+#include <pthread.h>
 
 #define me 510.999
 #define RADa 7.5657e-15
 
-void* pt2Object;
+// Potekhin's Fortran routines keep data between calls, so only one thread
+// at a time is allowed to call them
+static pthread_mutex_t potek_lock = PTHREAD_MUTEX_INITIALIZER;
 
 // Wrappers for Potekhin's conductivity and EOS routines
 extern "C"{
@@ -1149,15 +1152,14 @@ double Eos::expint(int n, double x)
 double Eos::find_rho(void)
 {
   double old, found, guess, rad, guess1;
-  pt2Object=(void*) this;
   old=this->rho;
 
 
-	if (Wrapper_find_rho_eqn(1e-6) > 0.0) return 1e-6;
+	if (find_rho_eqn(1e-6) > 0.0) return 1e-6;
  // if (2.521967e17*pow(this->T8,4)>this->P) return 1e-1;
 	//printf("find_rho: %g %g\n", Wrapper_find_rho_eqn(1e-6),Wrapper_find_rho_eqn(1e15));
 
-  found=zbrent(Wrapper_find_rho_eqn,1e-6,1e15,1e-6);
+  found=zbrent(Wrapper_find_rho_eqn,this,1e-6,1e15,1e-6);
 return found;
   if (0) {
   // first guess the density
@@ -1167,7 +1169,7 @@ return found;
   if (guess < 1e4) guess=(this->P-rad)*1.66e-24/
 		     ((this->Ye()+this->Yi())*1.38e-8*this->T8);
   guess1=guess;
-  while ((found = zbrent(Wrapper_find_rho_eqn,1e-1*guess,10.0*guess,1e-8))
+  while ((found = zbrent(Wrapper_find_rho_eqn,this,1e-1*guess,10.0*guess,1e-8))
 	 <= 0.12*guess) {
     guess/=9.0;
          printf("new guess=%lg\n", guess);
@@ -1187,9 +1189,9 @@ return found;
   }
 }
 
-double Eos::Wrapper_find_rho_eqn(double r)
+double Eos::Wrapper_find_rho_eqn(double r, void *p)
 {
-  Eos* mySelf = (Eos*) pt2Object;
+  Eos* mySelf = (Eos*) p;
   // call member
   return mySelf->find_rho_eqn(r);
 }
@@ -1353,8 +1355,10 @@ void Eos::potek_eos(double *P_out, double *cv_out_e, double *cv_out_i)
 	double GAMAG = 0.0;
 	double DENS, GAMI, CCHI, TPT, LIQSOL=1, PnkT, UNkT,SNk,CCVI,CCVE,CHIR,CHIT;
 //	if (TT<0.0) TT=100.0;
+	pthread_mutex_lock(&potek_lock);
 	eosm20_(&Zion,&CMI,&RR,&TT,&GAMAG,&DENS,&GAMI,&CCHI,&TPT,&LIQSOL,&PnkT,&UNkT,&SNk,&CCVE,&CCVI,
 			&CHIR,&CHIT);
+	pthread_mutex_unlock(&potek_lock);
 	//Multiply pressure by 8.31447e13 rho T6/CMImean to get cgs pressure
 	*P_out = PnkT * 8.31447e13 * this->rho * 100.0*this->T8/this->A[1];
 	*cv_out_e = CCVE * 8.31447e7/this->A[1];
@@ -1371,7 +1375,9 @@ double Eos::potek_cond(void)
 	double Bfield=this->B/4.414e13;
 	double temp=this->T8*1e2/5930.0;
 	double rr=this->rho/(this->A[1]*15819.4*1822.9);
+	pthread_mutex_lock(&potek_lock);
 	condegin_(&temp,&rr,&Bfield,&this->Z[1],&AA,&this->A[1],&Zimp, &s1,&s2,&s3,&k1,&k2,&k3);
+	pthread_mutex_unlock(&potek_lock);
 	this->Kperp = k2*2.778e15;
 	return k1*2.778e15;
 
@@ -0,0 +1,29 @@
+// fail.cc
+//
+// Fatal errors (see h/fail.h)
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include "../h/fail.h"
+
+static thread_local int throwing=0;
+
+void fail_by_throwing(int on)
+{
+	throwing=on;
+}
+
+void fail(const char *format, ...)
+// prints the printf-style message, and then exits or throws it
+{
+	Failure f;
+	va_list args;
+	va_start(args,format);
+	vsnprintf(f.message,sizeof(f.message),format,args);
+	va_end(args);
+	printf("%s\n", f.message);
+	if (throwing) throw f;
+	exit(1);
+}
@@ -0,0 +1,297 @@
+// class Fitter
+//
+// Levenberg-Marquardt fit (see h/fit.h). Each iteration finds the Jacobian of
+// the residuals by forward differences, running the ndim shifted models
+// together on the pool, and then tries the step
+//     (J^T J + lambda diag(J^T J)) dx = -J^T r
+// for three values of the damping lambda (a tenth of the current value, the
+// current value, and ten times it) at once, also in parallel. The lowest chisq
+// of the three is taken if it is an improvement, and its lambda becomes the
+// current one; otherwise lambda goes up by 100 and the steps are tried again
+// with the same Jacobian. Steps that would leave the priors are cut off at the
+// edges. The fit stops when an iteration lowers chisq by less than tol, or
+// when lambda gets so large that no step helps.
+//
+// The covariance of the coordinates is (J^T J)^-1 with the Jacobian at the best
+// fit, since the residuals are already divided by the errors. J^T J is the
+// Fisher matrix of the data, and the Laplace approximation to the evidence is
+//     log Z = -chisq/2 + (ndim/2) log(2 pi) + (1/2) log det(cov) - log V
+// where V is the volume of the priors. The Fisher mode (run_fisher) skips the
+// fit and finds these at the parameters in init.dat, with central differences
+// (2 ndim models, all run at once) for a more accurate Jacobian.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "../h/fit.h"
+#include "../h/timer.h"
+#include "../h/vector.h"
+
+Fitter::Fitter(Run &base, int nthreads) : sampler(base,nthreads)
+{
+	this->ndim=this->sampler.ndim;
+	this->ndata=base.data.n;
+	this->maxiter=100;
+	this->tol=1e-3;
+	this->fd_step=1e-3;
+	this->lambda=1e-3;
+	this->chisq=INFINITY;
+	this->logZ=NAN;
+	this->iter=0;
+	this->ncalls=0;
+}
+
+
+void Fitter::start(void)
+// starts from the parameters in init.dat (or the middle of the prior if they are outside it)
+{
+	int ndim=this->ndim;
+	this->x.resize(ndim);
+	this->r.resize(this->ndata);
+	this->J.resize(this->ndata*ndim);
+	this->cov.assign(ndim*ndim,NAN);
+	for (int d=0; d<ndim; d++) {
+		Prior &p=this->sampler.priors[d];
+		double x0=this->sampler.coordinate(d,this->sampler.base.get_parameter(p.name));
+		if (!(x0 >= p.min && x0 <= p.max)) x0=0.5*(p.min+p.max);
+		this->x[d]=x0;
+	}
+	double lnp;
+	this->sampler.evaluate(1,this->x.data(),&lnp,0,this->r.data());
+	this->ncalls++;
+	this->chisq=-2.0*lnp;
+	if (!isfinite(this->chisq)) {
+		printf("The model at the starting point failed, so there is nothing to fit from\n");
+		exit(1);
+	}
+	if (this->ndata <= ndim)
+		printf("Warning: %d data points for %d parameters\n", this->ndata, ndim);
+}
+
+
+void Fitter::jacobian(int central)
+// forward (or, if central is set, central) differences of the residuals at x,
+// with the ndim (or 2 ndim) models run in parallel
+{
+	int ndim=this->ndim, ndata=this->ndata, m=central ? 2 : 1;
+	std::vector<double> xp(m*ndim*ndim), lnp(m*ndim), rp(m*ndim*ndata), h(ndim);
+	for (int d=0; d<ndim; d++) {
+		Prior &p=this->sampler.priors[d];
+		h[d]=this->fd_step*(p.max-p.min);
+		// step inwards at the upper edge of the prior
+		if (this->x[d]+h[d] > p.max) h[d]=-h[d];
+		for (int k=0; k<m; k++) {
+			double *xk=&xp[(k*ndim+d)*ndim];
+			for (int e=0; e<ndim; e++) xk[e]=this->x[e];
+			xk[d] += (k == 0) ? h[d] : -h[d];
+		}
+		// one-sided at either edge
+		if (central && (this->x[d]-h[d] < p.min || this->x[d]-h[d] > p.max)) xp[(ndim+d)*ndim+d]=this->x[d];
+	}
+	this->sampler.evaluate(m*ndim,xp.data(),lnp.data(),0,rp.data());
+	this->ncalls+=m*ndim;
+	for (int d=0; d<ndim; d++) {
+		if (lnp[d] == -INFINITY || (central && lnp[ndim+d] == -INFINITY)) {
+			printf("Warning: the model failed for the derivative with respect to %s\n",
+				this->sampler.priors[d].name);
+		}
+		const double *rlo=&this->r[0];
+		double dx=h[d];
+		if (central && xp[(ndim+d)*ndim+d] != this->x[d]) {
+			rlo=&rp[(ndim+d)*ndata];
+			dx=2.0*h[d];
+		}
+		for (int j=0; j<ndata; j++) {
+			double drdx=(rp[d*ndata+j]-rlo[j])/dx;
+			this->J[j*ndim+d] = isfinite(drdx) ? drdx : 0.0;
+		}
+	}
+}
+
+
+int Fitter::trial(const double *lambdas, int n)
+// tries the steps for the n values of lambda, and moves to the best one if it
+// lowers chisq; returns 1 if it moved
+{
+	int ndim=this->ndim, ndata=this->ndata;
+	std::vector<double> A(ndim*ndim), g(ndim), a(ndim*ndim), dx(ndim);
+	for (int d=0; d<ndim; d++) {
+		g[d]=0.0;
+		for (int j=0; j<ndata; j++) g[d]-=this->J[j*ndim+d]*this->r[j];
+		for (int e=0; e<ndim; e++) {
+			A[d*ndim+e]=0.0;
+			for (int j=0; j<ndata; j++) A[d*ndim+e]+=this->J[j*ndim+d]*this->J[j*ndim+e];
+		}
+	}
+	double amax=0.0;
+	for (int d=0; d<ndim; d++) if (A[d*ndim+d] > amax) amax=A[d*ndim+d];
+
+	std::vector<double> xp(n*ndim), lnp(n), rp(n*ndata);
+	for (int k=0; k<n; k++) {
+		a=A;
+		// (a parameter that the data don't depend on still gets some damping)
+		for (int d=0; d<ndim; d++) a[d*ndim+d]+=lambdas[k]*fmax(A[d*ndim+d],1e-12*amax+1e-300);
+		if (cholesky(ndim,a.data())) cholesky_solve(ndim,a.data(),g.data(),dx.data());
+		else dx.assign(ndim,0.0);
+		for (int d=0; d<ndim; d++) {
+			Prior &p=this->sampler.priors[d];
+			double xd=this->x[d]+dx[d];
+			if (xd < p.min) xd=p.min;
+			if (xd > p.max) xd=p.max;
+			xp[k*ndim+d]=xd;
+		}
+	}
+	this->sampler.evaluate(n,xp.data(),lnp.data(),0,rp.data());
+	this->ncalls+=n;
+
+	int best=-1;
+	double chisq=this->chisq;
+	for (int k=0; k<n; k++) {
+		if (-2.0*lnp[k] < chisq) {
+			chisq=-2.0*lnp[k];
+			best=k;
+		}
+	}
+	if (best < 0) return 0;
+	for (int d=0; d<ndim; d++) this->x[d]=xp[best*ndim+d];
+	for (int j=0; j<ndata; j++) this->r[j]=rp[best*ndata+j];
+	this->chisq=chisq;
+	this->lambda=lambdas[best];
+	return 1;
+}
+
+
+int Fitter::fit(void)
+// iterates from the current point; returns 1 if it converged
+{
+	int need_jacobian=1;
+	double start=wall_time();
+	for (this->iter=1; this->iter<=this->maxiter; this->iter++) {
+		if (need_jacobian) jacobian();
+		double lambdas[3]={0.1*this->lambda,this->lambda,10.0*this->lambda};
+		double old=this->chisq;
+		if (trial(lambdas,3)) {
+			need_jacobian=1;
+			printf("fit: iteration %d chisq %.8g lambda %.3g models %d time %lg\n",
+				this->iter, this->chisq, this->lambda, this->ncalls, wall_time()-start);
+			if (old-this->chisq < this->tol) return 1;
+		} else {
+			// no step helps, so stay here with more damping
+			need_jacobian=0;
+			this->lambda*=100.0;
+			if (this->lambda > 1e10) return 1;
+		}
+	}
+	return 0;
+}
+
+
+int Fitter::covariance(void)
+// (J^T J)^-1 from the current Jacobian, and the Laplace log Z; returns 0 (and
+// leaves cov and logZ as NAN) if J^T J is singular
+{
+	int ndim=this->ndim, ndata=this->ndata;
+	std::vector<double> A(ndim*ndim), e(ndim), col(ndim);
+	for (int d=0; d<ndim; d++) {
+		for (int f=0; f<ndim; f++) {
+			A[d*ndim+f]=0.0;
+			for (int j=0; j<ndata; j++) A[d*ndim+f]+=this->J[j*ndim+d]*this->J[j*ndim+f];
+		}
+	}
+	this->cov.assign(ndim*ndim,NAN);
+	this->logZ=NAN;
+	if (!cholesky(ndim,A.data())) return 0;
+	for (int f=0; f<ndim; f++) {
+		e.assign(ndim,0.0);
+		e[f]=1.0;
+		cholesky_solve(ndim,A.data(),e.data(),col.data());
+		for (int d=0; d<ndim; d++) this->cov[d*ndim+f]=col[d];
+	}
+
+	// log det(cov) = -log det(J^T J) = -2 sum log L_dd
+	this->logZ=-0.5*this->chisq+0.5*ndim*log(2.0*M_PI);
+	for (int d=0; d<ndim; d++) {
+		Prior &p=this->sampler.priors[d];
+		this->logZ-=log(A[d*ndim+d])+log(p.max-p.min);
+	}
+	return 1;
+}
+
+
+void Fitter::write(FILE *fp)
+// the best fit as lines for init.dat, each with its error as a comment, and then the covariance
+{
+	int ndim=this->ndim;
+	fprintf(fp,"# chisq = %.8g for %d data points and %d parameters (chisq_nu = %lg)\n",
+		this->chisq, this->ndata, ndim, this->chisq/(this->ndata-ndim));
+	fprintf(fp,"# Laplace log Z = %.6g\n", this->logZ);
+	for (int d=0; d<ndim; d++) {
+		Prior &p=this->sampler.priors[d];
+		fprintf(fp,"%s\t%.8g\t# %s%s = %.8g +- %.3g\n", p.name, this->sampler.value(d,this->x[d]),
+			p.log ? "log10_" : "", p.name, this->x[d], sqrt(this->cov[d*ndim+d]));
+	}
+	fprintf(fp,"# covariance:");
+	for (int d=0; d<ndim; d++) fprintf(fp," %s%s",this->sampler.priors[d].log ? "log10_" : "",this->sampler.priors[d].name);
+	fprintf(fp,"\n");
+	for (int d=0; d<ndim; d++) {
+		fprintf(fp,"#");
+		for (int e=0; e<ndim; e++) fprintf(fp," %.6e",this->cov[d*ndim+e]);
+		fprintf(fp,"\n");
+	}
+}
+
+
+static void report(Fitter &fitter, const char *fname, FILE *out)
+// writes the result to the file fname and to out
+{
+	FILE *fp = fopen(fname,"w");
+	if (fp == NULL) {
+		printf("Could not open %s\n", fname);
+		exit(1);
+	}
+	fitter.write(fp);
+	fclose(fp);
+	fitter.write(out);
+}
+
+
+void run_fit(Run &base, const char *fname, int nthreads)
+{
+	// results go to stdout, so move everything else to stderr
+	fflush(stdout);
+	FILE *out = fdopen(dup(1),"w");
+	dup2(2,1);
+
+	double start=wall_time();
+	Fitter fitter(base,nthreads);
+	fitter.start();
+	int converged=fitter.fit();
+	fitter.jacobian();
+	if (!fitter.covariance()) printf("Warning: J^T J is singular, so there is no covariance\n");
+
+	if (!converged) fprintf(out,"Not converged after %d iterations\n", fitter.maxiter);
+	report(fitter,fname,out);
+	fprintf(out,"%d model evaluations in %lg s\n", fitter.ncalls, wall_time()-start);
+	fclose(out);
+}
+
+
+void run_fisher(Run &base, const char *fname, int nthreads)
+{
+	fflush(stdout);
+	FILE *out = fdopen(dup(1),"w");
+	dup2(2,1);
+
+	double start=wall_time();
+	Fitter fitter(base,nthreads);
+	fitter.start();
+	fitter.jacobian(1);
+	if (!fitter.covariance()) printf("Warning: the Fisher matrix is singular, so there is no covariance\n");
+
+	report(fitter,fname,out);
+	fprintf(out,"%d model evaluations in %lg s\n", fitter.ncalls, wall_time()-start);
+	fclose(out);
+}
@@ -0,0 +1,128 @@
+// class HeatingCache
+//
+// Memory and disk cache of end-of-outburst temperature profiles (see h/heatcache.h).
+// A file holds an 8 byte tag, the key, the number of points and then the profile.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../h/heatcache.h"
+
+static const char heatcache_tag[8]="crustht";
+
+HeatingCache &heating_cache(void)
+// the cache shared by every run in the process
+{
+	static HeatingCache cache;
+	return cache;
+}
+
+
+HeatingCache::HeatingCache()
+{
+	this->hits=0;
+	this->misses=0;
+}
+
+
+int HeatingCache::get(unsigned long long key, std::vector<double> &T, int nmax, int disk)
+// copies the profile for key into T; returns 0 if it is not in the cache
+{
+	{
+		std::lock_guard<std::mutex> guard(this->lock);
+		auto it = this->index.find(key);
+		if (it != this->index.end()) {
+			this->entries.splice(this->entries.begin(),this->entries,it->second);
+			T=it->second->T;
+			this->hits++;
+			return 1;
+		}
+	}
+	if (disk && read_file(key,T)) {
+		std::lock_guard<std::mutex> guard(this->lock);
+		insert(key,T,nmax);
+		this->hits++;
+		return 1;
+	}
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->misses++;
+	return 0;
+}
+
+
+void HeatingCache::put(unsigned long long key, const std::vector<double> &T, int nmax, int disk)
+// stores the profile for key, keeping at most nmax profiles in memory
+{
+	{
+		std::lock_guard<std::mutex> guard(this->lock);
+		insert(key,T,nmax);
+	}
+	if (disk) write_file(key,T);
+}
+
+
+void HeatingCache::insert(unsigned long long key, const std::vector<double> &T, int nmax)
+// (with the lock held)
+{
+	auto it = this->index.find(key);
+	if (it != this->index.end()) {
+		it->second->T=T;
+		this->entries.splice(this->entries.begin(),this->entries,it->second);
+	} else {
+		Entry e;
+		e.key=key;
+		e.T=T;
+		this->entries.push_front(e);
+		this->index[key]=this->entries.begin();
+	}
+	while ((int) this->entries.size() > nmax && !this->entries.empty()) {
+		this->index.erase(this->entries.back().key);
+		this->entries.pop_back();
+	}
+}
+
+
+void HeatingCache::filename(unsigned long long key, char *s)
+{
+	sprintf(s,"out/heatcache/%016llx",key);
+}
+
+
+int HeatingCache::read_file(unsigned long long key, std::vector<double> &T)
+{
+	char s[200];
+	filename(key,s);
+	FILE *fp = fopen(s,"rb");
+	if (fp == NULL) return 0;
+	char tag[8];
+	unsigned long long k;
+	int n, ok=0;
+	if (fread(tag,8,1,fp) == 1 && !strcmp(tag,heatcache_tag) && fread(&k,sizeof(k),1,fp) == 1 && k == key
+		&& fread(&n,sizeof(n),1,fp) == 1 && n > 0 && n < 100000) {
+		T.resize(n);
+		ok = (fread(T.data(),sizeof(double),n,fp) == (size_t) n);
+	}
+	fclose(fp);
+	return ok;
+}
+
+
+void HeatingCache::write_file(unsigned long long key, const std::vector<double> &T)
+{
+	// write to a temporary file first so that other runs never read a partial file
+	char s[200], tmpname[250];
+	filename(key,s);
+	sprintf(tmpname,"%s.%d.%p",s,(int) getpid(),(void *) &T);
+	mkdir("out/heatcache",0755);
+	FILE *fp = fopen(tmpname,"wb");
+	if (fp == NULL) return;
+	int n=(int) T.size();
+	fwrite(heatcache_tag,8,1,fp);
+	fwrite(&key,sizeof(key),1,fp);
+	fwrite(&n,sizeof(n),1,fp);
+	fwrite(T.data(),sizeof(double),n,fp);
+	fclose(fp);
+	rename(tmpname,s);
+}
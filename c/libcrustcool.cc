@@ -0,0 +1,142 @@
+// libcrustcool.cc
+//
+// C interface to crustcool (see h/libcrustcool.h)
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "../h/run.h"
+#include "../h/ensemble.h"
+#include "../h/fail.h"
+#include "../h/libcrustcool.h"
+
+struct crustcool {
+	Run run;
+	int evolved;
+	char error[256];
+};
+
+template <class F> static int guard(crustcool *cc, F f)
+// runs f with failures thrown rather than exiting; returns 0 (keeping the
+// message) if it failed, after which the model is set up from scratch next time
+{
+	cc->error[0]='\0';
+	fail_by_throwing(1);
+	try {
+		f();
+	} catch (Failure &e) {
+		fail_by_throwing(0);
+		strcpy(cc->error,e.message);
+		cc->run.invalidate(STAGE_SETUP);
+		cc->evolved=0;
+		return 0;
+	}
+	fail_by_throwing(0);
+	return 1;
+}
+
+crustcool *crustcool_new(void)
+{
+	crustcool *cc = new crustcool;
+	cc->evolved=0;
+	cc->error[0]='\0';
+	return cc;
+}
+
+void crustcool_free(crustcool *cc)
+{
+	delete cc;
+}
+
+int crustcool_read(crustcool *cc, const char *fname)
+{
+	int ok=0;
+	if (!guard(cc,[&] { ok=cc->run.read_parameters(fname); })) return 0;
+	return ok;
+}
+
+int crustcool_set(crustcool *cc, const char *key, double value)
+{
+	return cc->run.set_parameter(key,value);
+}
+
+int crustcool_set_string(crustcool *cc, const char *key, const char *value)
+{
+	return cc->run.set_string_parameter(key,value);
+}
+
+int crustcool_setup(crustcool *cc)
+{
+	return guard(cc,[&] { cc->run.setup(); });
+}
+
+double crustcool_evolve(crustcool *cc)
+{
+	double chisq=NAN;
+	if (!guard(cc,[&] { chisq=cc->run.run(); })) return NAN;
+	cc->evolved=1;
+	return chisq;
+}
+
+int crustcool_evolve_ensemble(crustcool *cc, int n, const double *Qimp, const double *Qinner,
+	const double *Tc, const double *Tt, const double *mdot, double *chisq)
+{
+	return guard(cc,[&] {
+		Ensemble ens(cc->run,n);
+		for (int m=0; m<n; m++) {
+			if (Qimp != NULL) ens.Qimp[m]=Qimp[m];
+			if (Qinner != NULL) ens.Qinner[m]=Qinner[m];
+			if (Tc != NULL) ens.Tc[m]=Tc[m];
+			if (Tt != NULL) ens.Tt[m]=Tt[m];
+			if (mdot != NULL) ens.mdot[m]=mdot[m];
+		}
+		ens.run();
+		for (int m=0; m<n; m++) chisq[m]=ens.chisq[m];
+		// the lightcurve left in Data is the last model's
+		cc->evolved=1;
+	});
+}
+
+double crustcool_chisq(crustcool *cc)
+{
+	return cc->run.chisq;
+}
+
+const char *crustcool_error(crustcool *cc)
+{
+	return cc->error;
+}
+
+int crustcool_lightcurve(crustcool *cc, const double **t, const double **y)
+{
+	if (!cc->evolved) return 0;
+	// the arrays in Data count from 1
+	*t = cc->run.data.tmodel+1;
+	*y = cc->run.data.ymodel+1;
+	return cc->run.data.nmodel;
+}
+
+int crustcool_profile(crustcool *cc, const double **P, const double **rho, const double **T, int *stride)
+{
+	Crust &crust = cc->run.crust;
+	if (crust.grid == NULL) return 0;
+	// the grid is an array of GridPoint structs, so each quantity is strided
+	*P = &crust.grid[1].P;
+	*rho = &crust.grid[1].rho;
+	*T = &crust.grid[1].T;
+	*stride = sizeof(GridPoint)/sizeof(double);
+	return crust.N+1;
+}
+
+void crustcool_pin(crustcool *cc)
+{
+	cc->run.data.pins++;
+	cc->run.crust.pins++;
+}
+
+void crustcool_unpin(crustcool *cc)
+{
+	cc->run.data.unpin();
+	cc->run.crust.unpin();
+}
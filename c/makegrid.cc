@@ -2,26 +2,162 @@
 //
 // Makes envelope models
 //
- 
+// With no arguments, asks for a single (yi, B) pair and writes the
+// text grid 'envelope_data/grid'.
+//
+// Batch mode builds a binary envelope library over lists of yi, B and g,
+//    makegrid -yi 0,4,9 -B 0,1e14,1e15 -g 1.5e14,2.28e14,3e14 [-j nproc] [-o file]
+// Every (flux, yi, B, g) model is independent, so they are handed out to
+// nproc worker processes which write into a shared block of memory.
+// The library is written to 'envelope_data/library' unless -o is given.
+//
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #include "../h/envelope.h"
+#include "../h/envlib.h"
+
+int parse_list(char *s, double *list, int nmax);
+void make_library(EnvelopeLibrary &lib, int nproc);
 
 //------------------------------------------------------------------------
 
 
-int main(void)
+int main(int argc, char *argv[])
+{
+	if (argc == 1) {
+		double yi, Bfield;
+
+		printf("Enter log10 base column of He layer  (0 to force iron)..."); scanf("%lg",&yi);
+		printf("Enter B field in G (0 for unmagnetized)..."); scanf("%lg",&Bfield);
+
+		Envelope envelope;
+		envelope.use_potek_eos_in_He=0;
+		envelope.use_potek_cond_in_He=0;
+		envelope.use_potek_eos_in_Fe=0;
+		envelope.use_potek_cond_in_Fe=0;
+		if (Bfield > 0.0) envelope.use_potek_kff=1;
+		else envelope.use_potek_kff=0;
+		envelope.make_grid(yi,Bfield);   // results are in "envelope_data/grid"
+		return 0;
+	}
+
+	// batch mode
+	double yi[100], B[100], g[100];
+	int nyi=0, nB=0, ng=0;
+	int nproc = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	char fname[200]="envelope_data/library";
+	for (int i=1; i<argc-1; i+=2) {
+		if (!strcmp(argv[i],"-yi")) nyi=parse_list(argv[i+1],yi,100);
+		else if (!strcmp(argv[i],"-B")) nB=parse_list(argv[i+1],B,100);
+		else if (!strcmp(argv[i],"-g")) ng=parse_list(argv[i+1],g,100);
+		else if (!strcmp(argv[i],"-j")) nproc=atoi(argv[i+1]);
+		else if (!strcmp(argv[i],"-o")) snprintf(fname,sizeof(fname),"%s",argv[i+1]);
+		else {
+			printf("Unknown option %s\n", argv[i]);
+			exit(1);
+		}
+	}
+	// defaults are the values used for the text grids
+	if (nyi == 0) { yi[0]=9.0; nyi=1; }
+	if (nB == 0) { B[0]=0.0; nB=1; }
+	if (ng == 0) { g[0]=2.28e14; ng=1; }
+	if (nproc < 1) nproc=1;
+
+	// flux and column depth grids
+	int nF=91, ny=101;
+
+	// the models are stored in memory shared with the worker processes
+	EnvelopeLibrary lib;
+	size_t bytes = sizeof(double)*nyi*nB*ng*nF*ny;   // (sizeof makes the product size_t)
+	double *data = (double *) mmap(NULL,bytes,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+	if (data == MAP_FAILED) {
+		printf("Could not allocate %lu bytes for the envelope library\n", (unsigned long) bytes);
+		exit(1);
+	}
+	lib.allocate(nyi,nB,ng,nF,ny,data);
+	for (size_t i=0; i<lib.size(); i++) lib.lgT[i]=NAN;   // marks models that fail
+	for (int i=0; i<nyi; i++) lib.yi[i]=yi[i];
+	for (int i=0; i<nB; i++) lib.B[i]=B[i];
+	for (int i=0; i<ng; i++) lib.g[i]=g[i];
+	for (int i=0; i<nF; i++) lib.lgF[i]=17.0+i*0.1;
+	for (int i=0; i<ny; i++) lib.lgy[i]=6.0+i*0.1;
+
+	printf("Making envelope library with %d yi x %d B x %d g x %d fluxes = %d models on %d processes\n",
+		nyi, nB, ng, nF, nyi*nB*ng*nF, nproc);
+	make_library(lib,nproc);
+	lib.write(fname);
+	printf("Envelope library written to %s\n", fname);
+
+	munmap(data,bytes);
+	return 0;
+}
+
+
+int parse_list(char *s, double *list, int nmax)
+// reads a comma separated list of numbers; returns the number of entries
+{
+	int n=0;
+	char *tok = strtok(s,",");
+	while (tok != NULL && n < nmax) {
+		list[n++] = atof(tok);
+		tok = strtok(NULL,",");
+	}
+	return n;
+}
+
+
+void make_library(EnvelopeLibrary &lib, int nproc)
+// solves every model in the library, using nproc worker processes
 {
-	double yi, Bfield;
-	
-	printf("Enter log10 base column of He layer  (0 to force iron)..."); scanf("%lg",&yi);
-	printf("Enter B field in G (0 for unmagnetized)..."); scanf("%lg",&Bfield);
-
-	Envelope envelope;
-	envelope.use_potek_eos_in_He=0;
-	envelope.use_potek_cond_in_He=0;
-	envelope.use_potek_eos_in_Fe=0;
-	envelope.use_potek_cond_in_Fe=0;
-	if (Bfield > 0.0) envelope.use_potek_kff=1;
-	else envelope.use_potek_kff=0;
-	envelope.make_grid(yi,Bfield);   // results are in "envelope_data/grid"
+	int nmodels = lib.nyi*lib.nB*lib.ng*lib.nF;
+
+	// shared counters: the next model to work on, and a completion flag for each model
+	int *shared = (int *) mmap(NULL,sizeof(int)*(nmodels+1),PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+	int *next = &shared[0];
+	int *done = &shared[1];
+	for (int i=0; i<=nmodels; i++) shared[i]=0;
+
+	// the models take different times to run (e.g. magnetized or not),
+	// so rather than splitting them up ahead of time each worker takes the
+	// next available model when it finishes the last one
+	fflush(stdout);
+	for (int w=0; w<nproc; w++) {
+		if (fork() == 0) {
+			Envelope envelope;
+			envelope.use_potek_eos_in_He=0;
+			envelope.use_potek_cond_in_He=0;
+			envelope.use_potek_eos_in_Fe=0;
+			envelope.use_potek_cond_in_Fe=0;
+
+			int k;
+			while ((k = __sync_fetch_and_add(next,1)) < nmodels) {
+				int iF = k % lib.nF;
+				int ig = (k/lib.nF) % lib.ng;
+				int iB = (k/(lib.nF*lib.ng)) % lib.nB;
+				int iyi = k/(lib.nF*lib.ng*lib.nB);
+				envelope.g = lib.g[ig];
+				if (lib.B[iB] > 0.0) envelope.use_potek_kff=1;
+				else envelope.use_potek_kff=0;
+				// (a model with no solution is left as NAN, like the points above the photosphere)
+				envelope.solve(lib.yi[iyi],lib.B[iB],pow(10.0,lib.lgF[iF]),lib.ny,lib.lgy,lib.profile(iyi,iB,ig,iF));
+				done[k]=1;
+				printf("."); fflush(stdout);
+			}
+			_exit(0);
+		}
+	}
+	for (int w=0; w<nproc; w++) wait(NULL);
+	printf("\n");
+
+	int nfailed=0;
+	for (int k=0; k<nmodels; k++) if (!done[k]) nfailed++;
+	if (nfailed) printf("Warning: %d models did not complete\n", nfailed);
+
+	munmap(shared,sizeof(int)*(nmodels+1));
 }
@@ -0,0 +1,245 @@
+// class NestedSampler
+//
+// Nested sampling for the evidence Z = integral of L dX (see h/nested.h). The
+// live points are kept in the unit cube, which maps linearly onto the priors
+// (in log10 of the parameter for a log prior), and the likelihood is
+// L = exp(-chisq/2).
+//
+// Each iteration removes the nbatch live points with the lowest likelihood at
+// once. They are counted as if removed one at a time, so that the prior volume
+// shrinks by exp(-1/n) for n = nlive, nlive-1, ..., and they are replaced by
+// nbatch random walks run side by side, each starting from one of the other
+// live points and accepting only steps with a likelihood above the highest one
+// removed. The steps are Gaussian, scaled by the spread of the live points in
+// each dimension, and the scale is adjusted to keep about half of them accepted.
+// Each step of the walks is one parallel evaluation of nbatch models.
+//
+// The run stops when the live points could add less than dlogz to log Z, and
+// the evidence error is sqrt(H/nlive) where H is the information.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <algorithm>
+#include <gsl/gsl_randist.h>
+#include "../h/nested.h"
+#include "../h/fail.h"
+#include "../h/timer.h"
+
+static double logaddexp(double a, double b)
+{
+	if (a == -INFINITY) return b;
+	if (b == -INFINITY) return a;
+	if (a > b) return a+log1p(exp(b-a));
+	return b+log1p(exp(a-b));
+}
+
+
+NestedSampler::NestedSampler(Run &base, int nthreads) : sampler(base,nthreads)
+{
+	this->ndim=this->sampler.ndim;
+	this->nlive=400;
+	this->nbatch=nthreads;
+	this->nwalk=20;
+	this->dlogz=0.1;
+	this->seed=1;
+	this->logZ=-INFINITY;
+	this->logZerr=0.0;
+	this->H=0.0;
+	this->ncalls=0;
+	this->scale=0.5;
+	this->rng=gsl_rng_alloc(gsl_rng_mt19937);
+}
+
+
+NestedSampler::~NestedSampler()
+{
+	gsl_rng_free(this->rng);
+}
+
+
+void NestedSampler::to_coordinates(int n, const double *u, double *x)
+{
+	for (int i=0; i<n; i++) {
+		for (int d=0; d<this->ndim; d++) {
+			Prior &p=this->sampler.priors[d];
+			x[i*this->ndim+d]=p.min+u[i*this->ndim+d]*(p.max-p.min);
+		}
+	}
+}
+
+
+void NestedSampler::evaluate(int n, const double *u, double *lnL)
+// log likelihoods of the n points u in the unit cube, in parallel
+// (points outside the cube are outside the priors and get -infinity)
+{
+	std::vector<double> x(n*this->ndim);
+	to_coordinates(n,u,x.data());
+	this->sampler.evaluate(n,x.data(),lnL);
+	this->ncalls+=n;
+}
+
+
+void NestedSampler::add_dead(int k, double logw)
+// moves live point k to the dead points with prior weight exp(logw), and
+// updates the evidence and the information
+{
+	double L=this->lnL[k];
+	for (int d=0; d<this->ndim; d++) this->dead_u.push_back(this->u[k*this->ndim+d]);
+	this->dead_lnL.push_back(L);
+	this->dead_logw.push_back(logw);
+	if (L+logw == -INFINITY) return;
+	double logZnew=logaddexp(this->logZ,L+logw);
+	double Hnew=exp(L+logw-logZnew)*L-logZnew;
+	if (this->logZ > -INFINITY) Hnew+=exp(this->logZ-logZnew)*(this->H+this->logZ);
+	this->H=Hnew;
+	this->logZ=logZnew;
+}
+
+
+void NestedSampler::replace(const std::vector<int> &worst, double lnLmin)
+// replaces the live points in worst with new points that have lnL > lnLmin
+{
+	int ndim=this->ndim, k=(int) worst.size();
+
+	// the walks start from live points that are above the threshold
+	std::vector<int> starts;
+	std::vector<char> removed(this->nlive,0);
+	for (int i=0; i<k; i++) removed[worst[i]]=1;
+	for (int j=0; j<this->nlive; j++) if (!removed[j] && this->lnL[j] > lnLmin) starts.push_back(j);
+	if (starts.empty()) for (int j=0; j<this->nlive; j++) if (!removed[j]) starts.push_back(j);
+
+	// the spread of the live points sets the step in each dimension
+	std::vector<double> sd(ndim);
+	for (int d=0; d<ndim; d++) {
+		double m=0.0, m2=0.0;
+		for (int j=0; j<this->nlive; j++) {
+			m+=this->u[j*ndim+d];
+			m2+=this->u[j*ndim+d]*this->u[j*ndim+d];
+		}
+		m/=this->nlive;
+		sd[d]=sqrt(fmax(m2/this->nlive-m*m,1e-12));
+	}
+
+	std::vector<double> cur(k*ndim), curL(k), prop(k*ndim), propL(k);
+	for (int i=0; i<k; i++) {
+		int j=starts[gsl_rng_uniform_int(this->rng,starts.size())];
+		for (int d=0; d<ndim; d++) cur[i*ndim+d]=this->u[j*ndim+d];
+		curL[i]=this->lnL[j];
+	}
+	int naccept=0;
+	for (int s=0; s<this->nwalk; s++) {
+		for (int i=0; i<k; i++)
+			for (int d=0; d<ndim; d++)
+				prop[i*ndim+d]=cur[i*ndim+d]+this->scale*sd[d]*gsl_ran_gaussian(this->rng,1.0);
+		evaluate(k,prop.data(),propL.data());
+		for (int i=0; i<k; i++) {
+			if (propL[i] > lnLmin) {
+				for (int d=0; d<ndim; d++) cur[i*ndim+d]=prop[i*ndim+d];
+				curL[i]=propL[i];
+				naccept++;
+			}
+		}
+	}
+	// aim for half of the steps accepted
+	double acc=(double) naccept/(k*this->nwalk);
+	this->scale*=exp(acc-0.5);
+	if (this->scale > 1.0) this->scale=1.0;
+
+	for (int i=0; i<k; i++) {
+		for (int d=0; d<ndim; d++) this->u[worst[i]*ndim+d]=cur[i*ndim+d];
+		this->lnL[worst[i]]=curL[i];
+	}
+}
+
+
+void NestedSampler::run(void)
+{
+	int ndim=this->ndim, nlive=this->nlive;
+	if (nlive < 2) fail("Nested sampling needs at least 2 live points (nlive=%d)", nlive);
+	gsl_rng_set(this->rng,this->seed);
+	if (this->nbatch < 1) this->nbatch=1;
+	if (this->nbatch > nlive/2) this->nbatch=nlive/2;
+
+	// live points drawn from the prior
+	this->u.resize(nlive*ndim);
+	this->lnL.resize(nlive);
+	for (int j=0; j<nlive*ndim; j++) this->u[j]=gsl_rng_uniform(this->rng);
+	evaluate(nlive,this->u.data(),this->lnL.data());
+
+	double logX=0.0, start=wall_time();
+	std::vector<int> order(nlive);
+	for (int iter=1; ; iter++) {
+		for (int j=0; j<nlive; j++) order[j]=j;
+		std::sort(order.begin(),order.end(),[&](int a, int b) { return this->lnL[a] < this->lnL[b]; });
+
+		// stop when the remaining prior volume can't change log Z by more than dlogz
+		double Lmax=this->lnL[order[nlive-1]];
+		if (this->logZ > -INFINITY && logaddexp(this->logZ,Lmax+logX)-this->logZ < this->dlogz) break;
+
+		std::vector<int> worst(order.begin(),order.begin()+this->nbatch);
+		double lnLmin=this->lnL[worst.back()];
+		for (int i=0; i<this->nbatch; i++) {
+			double dlogX=1.0/(nlive-i);
+			add_dead(worst[i],logX+log(-expm1(-dlogX)));
+			logX-=dlogX;
+		}
+		replace(worst,lnLmin);
+
+		if (iter%10 == 0) {
+			printf("nested: iteration %d calls %d logX %.3f lnLmin %.6g logZ %.6g time %lg\n",
+				iter, this->ncalls, logX, lnLmin, this->logZ, wall_time()-start);
+		}
+	}
+
+	// the live points share the remaining prior volume
+	for (int j=0; j<nlive; j++) add_dead(order[j],logX-log((double) nlive));
+	this->logZerr=sqrt(fmax(this->H,0.0)/nlive);
+}
+
+
+void NestedSampler::write_samples(const char *fname)
+// the dead points as posterior samples: "weight lnL x1 ... xn", with the weights normalized to 1
+{
+	FILE *fp = fopen(fname,"w");
+	if (fp == NULL) {
+		printf("Could not open %s\n", fname);
+		exit(1);
+	}
+	fprintf(fp,"# logZ = %.6g +- %.3g\n# weight lnL",this->logZ,this->logZerr);
+	for (int d=0; d<this->ndim; d++)
+		fprintf(fp," %s%s",this->sampler.priors[d].log ? "log10_" : "",this->sampler.priors[d].name);
+	fprintf(fp,"\n");
+	std::vector<double> x(this->ndim);
+	for (int j=0; j<(int) this->dead_lnL.size(); j++) {
+		double w=exp(this->dead_logw[j]+this->dead_lnL[j]-this->logZ);
+		to_coordinates(1,&this->dead_u[j*this->ndim],x.data());
+		fprintf(fp,"%.6e %.10g",w,this->dead_lnL[j]);
+		for (int d=0; d<this->ndim; d++) fprintf(fp," %.10g",x[d]);
+		fprintf(fp,"\n");
+	}
+	fclose(fp);
+}
+
+
+void run_nested(Run &base, const char *fname, int nthreads, int nlive, int nwalk, unsigned long seed)
+{
+	// results go to stdout, so move everything else to stderr
+	fflush(stdout);
+	FILE *out = fdopen(dup(1),"w");
+	dup2(2,1);
+
+	NestedSampler ns(base,nthreads);
+	if (nlive > 0) ns.nlive=nlive;
+	if (nwalk > 0) ns.nwalk=nwalk;
+	ns.seed=seed;
+	double start=wall_time();
+	ns.run();
+	ns.write_samples(fname);
+	fprintf(out,"logZ = %.6g +- %.3g\n", ns.logZ, ns.logZerr);
+	fprintf(out,"H = %.4g nats, %d model evaluations in %lg s\n", ns.H, ns.ncalls, wall_time()-start);
+	fclose(out);
+}
@@ -9,11 +9,11 @@
 #include <gsl/gsl_errno.h>
 
 
-void *pointer_to_OdeInt;
+// GSL passes the Ode_Int object back to these functions through 'params'
 
 int Ode_Int::gsl_derivs (double t, const double y[], double dydt[], void * params)
 {
-	Ode_Int *myself = (Ode_Int*) pointer_to_OdeInt;
+	Ode_Int *myself = (Ode_Int*) params;
 
 	for (int i=1; i<=myself->nvar; i++)
 		myself->derivs_y[i] = y[i-1];
@@ -29,7 +29,7 @@ int Ode_Int::gsl_derivs (double t, const double y[], double dydt[], void * param
 
 int Ode_Int::gsl_jacobn (double t, const double y[], double *dfdy,double dfdt[], void *params)
 {
-	Ode_Int *myself = (Ode_Int*) pointer_to_OdeInt;
+	Ode_Int *myself = (Ode_Int*) params;
 
 	for (int i=1; i<=myself->nvar; i++)
 		myself->derivs_y[i] = y[i-1];
@@ -45,21 +45,32 @@ int Ode_Int::gsl_jacobn (double t, const double y[], double *dfdy,double dfdt[],
 	return GSL_SUCCESS;	
 }
 
+Ode_Int::Ode_Int()
+{
+	this->nvar=0;   // storage is allocated in init
+}
+
 void Ode_Int::tidy(void)
 {
+	if (this->nvar == 0) return;
 	free_vector(this->ystart);
 	free_vector(this->ynext);
 	free_vector(this->hstr);
 	free_vector(this->xp);
 	free_matrix(this->yp,this->nvar,this->kmax);
 	free_matrix(this->dydxp,this->nvar,this->kmax);
+	this->nvar=0;
 }
 
 void Ode_Int::init(int n, Ode_Int_Delegate *delegate)
 {
+	if (this->nvar != 0) tidy();    // already initialized
 	this->delegate = delegate;
 
-	this->kmax=900000;
+	// the stored steps start small and grow as needed (see reserve), rather than
+	// allocating room for maxsteps outputs of every variable up front
+	this->kmax=1000;
+	this->maxsteps=900000;
 	this->nvar=n;
 	this->ignore=0;
 	this->dxsav=0.0;
@@ -81,6 +92,26 @@ void Ode_Int::init(int n, Ode_Int_Delegate *delegate)
 	this->use_gsl=1;  // use the GSL integrator
 }
 
+void Ode_Int::reserve(int n)
+// makes sure there is room to store n steps, keeping the first kount
+{
+	if (n <= this->kmax) return;
+	int kmax=this->kmax;
+	while (kmax < n) kmax*=2;
+	double *v;
+	v=vector(kmax); for (int k=1; k<=this->kount; k++) v[k]=this->xp[k];
+	free_vector(this->xp); this->xp=v;
+	v=vector(kmax); for (int k=1; k<=this->kount; k++) v[k]=this->hstr[k];
+	free_vector(this->hstr); this->hstr=v;
+	for (int i=1; i<=this->nvar; i++) {
+		v=vector(kmax); for (int k=1; k<=this->kount; k++) v[k]=this->yp[i][k];
+		free_vector(this->yp[i]); this->yp[i]=v;
+		v=vector(kmax); for (int k=1; k<=this->kount; k++) v[k]=this->dydxp[i][k];
+		free_vector(this->dydxp[i]); this->dydxp[i]=v;
+	}
+	this->kmax=kmax;
+}
+
 void Ode_Int::set_bc(int n, double num)
 {
   this->ystart[n]=num;
@@ -116,8 +147,6 @@ void Ode_Int::go_simple(double x1, double x2, int nstep)
 
 void Ode_Int::go_gsl(double x1, double x2, int nsteps, double eps, int log_flag)
 {
-	pointer_to_OdeInt = (void*) this;
-
 	if (this->verbose) printf("Number of steps=%d\n",nsteps);
 
 	double xstep;
@@ -131,7 +160,7 @@ void Ode_Int::go_gsl(double x1, double x2, int nsteps, double eps, int log_flag)
 		for (int j=1; j<=this->nvar; j++)
 			this->derivs_dfdy[i][j] = 0.0;
 
-	this->sys = (gsl_odeiv2_system) {gsl_derivs,gsl_jacobn,this->nvar,NULL};
+	this->sys = (gsl_odeiv2_system) {gsl_derivs,gsl_jacobn,(size_t) this->nvar,this};
 //	if (this->stiff) this->step=gsl_odeiv2_step_alloc (gsl_odeiv2_step_bsimp,this->nvar);
 //	else this->step=gsl_odeiv2_step_alloc (gsl_odeiv2_step_rkf45,this->nvar);
 //	this->control=gsl_odeiv2_control_y_new(0.0,eps);
@@ -141,6 +170,8 @@ void Ode_Int::go_gsl(double x1, double x2, int nsteps, double eps, int log_flag)
 	double x = x1;
 	double h = xstep;
 	
+	this->kount=0;
+	reserve(nsteps+1);
 	for (int i=1; i<=this->nvar; i++) {
 		this->ynext[i-1]=this->ystart[i];
 		this->yp[i][1]=this->ystart[i];
@@ -154,7 +185,7 @@ void Ode_Int::go_gsl(double x1, double x2, int nsteps, double eps, int log_flag)
 	
 		double xnext;
 		if (log_flag) xnext = pow(10.0,log10(x2)*j/(1.0*nsteps));
-		else xnext = (x2-x1)*j/(1.0*nsteps);
+		else xnext = x1 + (x2-x1)*j/(1.0*nsteps);
 		status=gsl_odeiv2_driver_apply (this->driver,&x,xnext,this->ynext);
 
 		if (this->verbose) printf("%lg %lg %lg %d\n",x1,x2,xnext,status);
@@ -162,10 +193,11 @@ void Ode_Int::go_gsl(double x1, double x2, int nsteps, double eps, int log_flag)
 		if (status != GSL_SUCCESS) break;
 
 		this->kount++;
-		if (this->kount == this->kmax) {
+		if (this->kount == this->maxsteps) {
 			printf("Maximum number of steps reached! Stopping integrator.\n");
 			break;
 		}
+		reserve(this->kount);
 
 		this->xp[this->kount]=x;
 		for (int i=1; i<=this->nvar; i++) {
@@ -205,3 +237,100 @@ void Ode_Int::go_gsl(double x1, double x2, int nsteps, double eps, int log_flag)
 	free_vector(this->derivs_y);
 	free_vector(this->derivs_dydt);
 }
+
+
+
+void Ode_Int::go_scalar(double x1, double x2, double eps, int nout, double *xout)
+// Adaptive Cash-Karp Runge-Kutta integrator for a single equation (nvar=1).
+// The step size is controlled to keep the relative error below eps. The result is 
+// only stored at x1, at the points in xout[0..nout-1] that lie between x1 and x2, and at x2,
+// with the steps adjusted to land on those points. Unlike go_gsl there is no driver
+// to set up, which matters when there are many short integrations.
+{
+	double x=x1, y=this->ystart[1];
+	double ys[2], dys[2];
+	ys[1]=y; this->delegate->derivs(x,ys,dys);
+	double dydx=dys[1];
+
+	this->xp[1]=x; this->yp[1][1]=y; this->dydxp[1][1]=dydx;
+	this->kount=1;
+
+	double h=0.01*(x2-x1);
+	if (this->hmax < fabs(x2-x1) && this->hmax > 0.0) h=this->hmax*(x2>x1 ? 1.0 : -1.0);
+	int k=0;   // next output point
+	while (k < nout && (xout[k]-x1)*(x2-x1) <= 0.0) k++;
+
+	for (int nstep=0; nstep<this->maxsteps; nstep++) {
+		// the next point we need to stop at
+		double xstop = x2;
+		if (k < nout && (xout[k]-x2)*(x2-x1) < 0.0) xstop=xout[k];
+		int last = 0;
+		if ((x+h-xstop)*(x2-x1) >= 0.0) { h=xstop-x; last=1; }
+
+		double yerr;
+		double ynew=rkck_scalar(x,y,dydx,h,&yerr);
+		double errmax=fabs(yerr)/(eps*fabs(y)+1e-30);
+		if (errmax > 1.0) {
+			// step failed, reduce the step size by up to a factor of 10
+			double htemp=0.9*h*pow(errmax,-0.25);
+			h = (h >= 0.0 ? fmax(htemp,0.1*h) : fmin(htemp,0.1*h));
+			if (fabs(h) < 1e-12*fabs(x2-x1)) {
+				printf("go_scalar: step size underflow at x=%lg\n", x);
+				return;
+			}
+			continue;
+		}
+
+		x += h; y = ynew;
+		ys[1]=y; this->delegate->derivs(x,ys,dys);
+		dydx=dys[1];
+
+		if (last) {
+			this->kount++;
+			reserve(this->kount);
+			this->xp[this->kount]=x; this->yp[1][this->kount]=y; this->dydxp[1][this->kount]=dydx;
+			if (xstop == x2) return;
+			k++;
+		}
+
+		// grow the step by no more than a factor of 5
+		if (errmax > 1.89e-4) h*=0.9*pow(errmax,-0.2);
+		else h*=5.0;
+		if (this->hmax > 0.0 && fabs(h) > this->hmax) h=this->hmax*(h>0.0 ? 1.0 : -1.0);
+		if (this->kount == this->maxsteps) {
+			printf("Maximum number of steps reached! Stopping integrator.\n");
+			return;
+		}
+	}
+	printf("go_scalar: too many steps\n");
+}
+
+
+double Ode_Int::rkck_scalar(double x, double y, double dydx, double h, double *yerr)
+// Cash-Karp Runge-Kutta step for a single equation; returns y(x+h) and the error estimate
+{
+	static const double a2=0.2,a3=0.3,a4=0.6,a5=1.0,a6=0.875,b21=0.2,
+		b31=3.0/40.0,b32=9.0/40.0,b41=0.3,b42 = -0.9,b43=1.2,
+		b51 = -11.0/54.0, b52=2.5,b53 = -70.0/27.0,b54=35.0/27.0,
+		b61=1631.0/55296.0,b62=175.0/512.0,b63=575.0/13824.0,
+		b64=44275.0/110592.0,b65=253.0/4096.0,c1=37.0/378.0,
+		c3=250.0/621.0,c4=125.0/594.0,c6=512.0/1771.0,
+		dc5 = -277.00/14336.0;
+	static const double dc1=c1-2825.0/27648.0,dc3=c3-18575.0/48384.0,
+		dc4=c4-13525.0/55296.0,dc6=c6-0.25;
+	double ys[2], ak2[2], ak3[2], ak4[2], ak5[2], ak6[2];
+
+	ys[1]=y+b21*h*dydx;
+	this->delegate->derivs(x+a2*h,ys,ak2);
+	ys[1]=y+h*(b31*dydx+b32*ak2[1]);
+	this->delegate->derivs(x+a3*h,ys,ak3);
+	ys[1]=y+h*(b41*dydx+b42*ak2[1]+b43*ak3[1]);
+	this->delegate->derivs(x+a4*h,ys,ak4);
+	ys[1]=y+h*(b51*dydx+b52*ak2[1]+b53*ak3[1]+b54*ak4[1]);
+	this->delegate->derivs(x+a5*h,ys,ak5);
+	ys[1]=y+h*(b61*dydx+b62*ak2[1]+b63*ak3[1]+b64*ak4[1]+b65*ak5[1]);
+	this->delegate->derivs(x+a6*h,ys,ak6);
+
+	*yerr=h*(dc1*dydx+dc3*ak3[1]+dc4*ak4[1]+dc5*ak5[1]+dc6*ak6[1]);
+	return y+h*(c1*dydx+c3*ak3[1]+c4*ak4[1]+c6*ak6[1]);
+}
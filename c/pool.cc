@@ -0,0 +1,90 @@
+// class ThreadPool
+//
+// Work-stealing thread pool (see h/pool.h). Tasks are dealt out to the workers'
+// queues in turn; a worker that runs out of tasks steals from the others, so that
+// a few slow tasks do not leave the rest of the workers idle.
+//
+
+#include "../h/pool.h"
+
+ThreadPool::ThreadPool(int nthreads)
+{
+	if (nthreads < 1) nthreads=1;
+	this->nthreads=nthreads;
+	this->queued=0;
+	this->pending=0;
+	this->next=0;
+	this->stopping=0;
+	for (int w=0; w<nthreads; w++) this->queues.push_back(new Queue);
+	for (int w=0; w<nthreads; w++) this->threads.push_back(std::thread(&ThreadPool::work,this,w));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::unique_lock<std::mutex> g(this->lock);
+		this->stopping=1;
+	}
+	this->wake.notify_all();
+	for (int w=0; w<this->nthreads; w++) this->threads[w].join();
+	for (int w=0; w<this->nthreads; w++) delete this->queues[w];
+}
+
+void ThreadPool::submit(Task task)
+{
+	std::unique_lock<std::mutex> g(this->lock);
+	Queue *q = this->queues[this->next];
+	this->next = (this->next+1) % this->nthreads;
+	{
+		std::unique_lock<std::mutex> qg(q->lock);
+		q->tasks.push_back(task);
+	}
+	this->queued++;
+	this->pending++;
+	this->wake.notify_one();
+}
+
+void ThreadPool::wait(void)
+{
+	std::unique_lock<std::mutex> g(this->lock);
+	while (this->pending > 0) this->idle.wait(g);
+}
+
+int ThreadPool::take(int w, Task &task)
+// gets a task for worker w, first from its own queue and then from the others
+{
+	for (int k=0; k<this->nthreads; k++) {
+		Queue *q = this->queues[(w+k) % this->nthreads];
+		std::unique_lock<std::mutex> qg(q->lock);
+		if (q->tasks.empty()) continue;
+		if (k == 0) {
+			task = q->tasks.back();
+			q->tasks.pop_back();
+		} else {
+			task = q->tasks.front();
+			q->tasks.pop_front();
+		}
+		qg.unlock();
+		std::unique_lock<std::mutex> g(this->lock);
+		this->queued--;
+		return 1;
+	}
+	return 0;
+}
+
+void ThreadPool::work(int w)
+{
+	Task task;
+	while (1) {
+		if (take(w,task)) {
+			task(w);
+			std::unique_lock<std::mutex> g(this->lock);
+			if (--this->pending == 0) this->idle.notify_all();
+			continue;
+		}
+		std::unique_lock<std::mutex> g(this->lock);
+		if (this->queued > 0) continue;
+		if (this->stopping) return;
+		this->wake.wait(g);
+	}
+}
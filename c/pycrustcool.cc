@@ -0,0 +1,293 @@
+// pycrustcool.cc
+//
+// Python module 'crustcool' (build with 'make python')
+//
+//     import crustcool
+//     m = crustcool.Model('init.dat')      # the parameter file is optional
+//     m.set(Tc=3e7, Qimp=2.0, source='1659')
+//     chisq = m.evolve()
+//     t, Teff = m.lightcurve()
+//     P, rho, T = m.profile()
+//     chisq = m.evolve_ensemble(Qimp=[1,2,3], Tc=[3e7,3e7,4e7])
+//
+// Each Model keeps its grid, envelope and precalculated tables, so only the
+// first evolve (or one after changing e.g. Bfield or mass) pays for the setup.
+// evolve() releases the GIL, so different Models can run on different threads.
+//
+// lightcurve() and profile() return read-only NumPy views of the model's own
+// buffers, without copying. They show the result of the last evolve() and are
+// overwritten by the next one; the views keep the Model alive and pin its
+// buffers (see libcrustcool.h), so a view is never left pointing at freed memory
+// even if the buffer it shows is replaced, but use np.copy to keep a result.
+// An error in the model (e.g. an unreadable file, or parameters it can't use)
+// raises RuntimeError rather than ending the interpreter.
+//
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include <numpy/arrayobject.h>
+#include "../h/libcrustcool.h"
+
+typedef struct {
+	PyObject_HEAD
+	crustcool *cc;
+} Model;
+
+
+static void unpin(PyObject *capsule)
+{
+	Model *self = (Model *) PyCapsule_GetPointer(capsule,"crustcool.pin");
+	crustcool_unpin(self->cc);
+	Py_DECREF(self);
+}
+
+static PyObject *pin(Model *self)
+// the base object for views of the model's buffers, which holds a reference to the
+// Model and pins its buffers until the last view goes
+{
+	PyObject *capsule = PyCapsule_New(self,"crustcool.pin",unpin);
+	if (capsule == NULL) return NULL;
+	Py_INCREF(self);
+	crustcool_pin(self->cc);
+	return capsule;
+}
+
+static PyObject *view(PyObject *base, const double *data, npy_intp n, npy_intp stride)
+// a read-only array of the n doubles spaced stride doubles apart, kept valid by base
+{
+	npy_intp bytes = stride*(npy_intp) sizeof(double);
+	PyObject *a = PyArray_New(&PyArray_Type,1,&n,NPY_DOUBLE,&bytes,(void *) data,0,0,NULL);
+	if (a == NULL) return NULL;
+	Py_INCREF(base);
+	if (PyArray_SetBaseObject((PyArrayObject *) a,base) < 0) {
+		Py_DECREF(a);
+		return NULL;
+	}
+	return a;
+}
+
+static PyObject *error(Model *self)
+{
+	PyErr_SetString(PyExc_RuntimeError,crustcool_error(self->cc));
+	return NULL;
+}
+
+
+static int Model_init(Model *self, PyObject *args, PyObject *kwds)
+{
+	const char *fname=NULL;
+	if (!PyArg_ParseTuple(args,"|s",&fname)) return -1;
+	if (self->cc == NULL) self->cc = crustcool_new();
+	if (fname != NULL && !crustcool_read(self->cc,fname)) {
+		if (crustcool_error(self->cc)[0] != '\0') PyErr_SetString(PyExc_RuntimeError,crustcool_error(self->cc));
+		else PyErr_Format(PyExc_IOError,"could not read %s",fname);
+		return -1;
+	}
+	return 0;
+}
+
+static void Model_dealloc(Model *self)
+{
+	if (self->cc != NULL) crustcool_free(self->cc);
+	Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyObject *Model_read(Model *self, PyObject *args)
+{
+	const char *fname;
+	if (!PyArg_ParseTuple(args,"s",&fname)) return NULL;
+	if (!crustcool_read(self->cc,fname)) {
+		if (crustcool_error(self->cc)[0] != '\0') return error(self);
+		PyErr_Format(PyExc_IOError,"could not read %s",fname);
+		return NULL;
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject *Model_set(Model *self, PyObject *args, PyObject *kwds)
+// sets parameters given as keyword arguments, e.g. m.set(Tc=3e7, source='1659')
+{
+	PyObject *key, *value;
+	Py_ssize_t pos=0;
+	if (kwds == NULL) Py_RETURN_NONE;
+	while (PyDict_Next(kwds,&pos,&key,&value)) {
+		const char *name = PyUnicode_AsUTF8(key);
+		if (name == NULL) return NULL;
+		int found;
+		if (PyUnicode_Check(value)) {
+			found = crustcool_set_string(self->cc,name,PyUnicode_AsUTF8(value));
+		} else {
+			double x = PyFloat_AsDouble(value);
+			if (x == -1.0 && PyErr_Occurred()) return NULL;
+			found = crustcool_set(self->cc,name,x);
+		}
+		if (!found) {
+			PyErr_Format(PyExc_KeyError,"unknown parameter %s",name);
+			return NULL;
+		}
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject *Model_setup(Model *self, PyObject *unused)
+{
+	int ok;
+	Py_BEGIN_ALLOW_THREADS
+	ok = crustcool_setup(self->cc);
+	Py_END_ALLOW_THREADS
+	if (!ok) return error(self);
+	Py_RETURN_NONE;
+}
+
+static PyObject *Model_evolve(Model *self, PyObject *unused)
+{
+	double chisq;
+	Py_BEGIN_ALLOW_THREADS
+	chisq = crustcool_evolve(self->cc);
+	Py_END_ALLOW_THREADS
+	if (crustcool_error(self->cc)[0] != '\0') return error(self);
+	return PyFloat_FromDouble(chisq);
+}
+
+static PyObject *Model_evolve_ensemble(Model *self, PyObject *args, PyObject *kwds)
+// evolves several models at once, e.g. m.evolve_ensemble(Qimp=[1,2], Tc=[3e7,4e7]);
+// parameters that are not given take the Model's value. Returns an array of chi-squared.
+{
+	static const char *names[] = {"Qimp", "Qinner", "Tc", "Tt", "mdot", NULL};
+	PyObject *objs[5] = {NULL, NULL, NULL, NULL, NULL};
+	if (!PyArg_ParseTupleAndKeywords(args,kwds,"|OOOOO",(char **) names,
+		&objs[0],&objs[1],&objs[2],&objs[3],&objs[4])) return NULL;
+
+	PyArrayObject *arrays[5] = {NULL, NULL, NULL, NULL, NULL};
+	const double *data[5] = {NULL, NULL, NULL, NULL, NULL};
+	npy_intp n=-1;
+	for (int k=0; k<5; k++) {
+		if (objs[k] == NULL || objs[k] == Py_None) continue;
+		arrays[k] = (PyArrayObject *) PyArray_FROMANY(objs[k],NPY_DOUBLE,1,1,NPY_ARRAY_IN_ARRAY);
+		if (arrays[k] == NULL) goto fail;
+		if (n >= 0 && PyArray_DIM(arrays[k],0) != n) {
+			PyErr_SetString(PyExc_ValueError,"the parameter arrays must have the same length");
+			goto fail;
+		}
+		n = PyArray_DIM(arrays[k],0);
+		data[k] = (const double *) PyArray_DATA(arrays[k]);
+	}
+	if (n <= 0) {
+		PyErr_SetString(PyExc_ValueError,"give at least one parameter array");
+		goto fail;
+	}
+	{
+		PyObject *chisq = PyArray_SimpleNew(1,&n,NPY_DOUBLE);
+		if (chisq == NULL) goto fail;
+		double *out = (double *) PyArray_DATA((PyArrayObject *) chisq);
+		int ok;
+		Py_BEGIN_ALLOW_THREADS
+		ok = crustcool_evolve_ensemble(self->cc,(int) n,data[0],data[1],data[2],data[3],data[4],out);
+		Py_END_ALLOW_THREADS
+		for (int k=0; k<5; k++) Py_XDECREF(arrays[k]);
+		if (!ok) {
+			Py_DECREF(chisq);
+			return error(self);
+		}
+		return chisq;
+	}
+fail:
+	for (int k=0; k<5; k++) Py_XDECREF(arrays[k]);
+	return NULL;
+}
+
+static PyObject *Model_chisq(Model *self, PyObject *unused)
+{
+	return PyFloat_FromDouble(crustcool_chisq(self->cc));
+}
+
+static PyObject *Model_lightcurve(Model *self, PyObject *unused)
+{
+	const double *t, *y;
+	int n = crustcool_lightcurve(self->cc,&t,&y);
+	if (n == 0) {
+		PyErr_SetString(PyExc_RuntimeError,"the model has not been evolved");
+		return NULL;
+	}
+	PyObject *base = pin(self);
+	if (base == NULL) return NULL;
+	PyObject *at = view(base,t,n,1);
+	PyObject *ay = view(base,y,n,1);
+	Py_DECREF(base);
+	if (at == NULL || ay == NULL) {
+		Py_XDECREF(at); Py_XDECREF(ay);
+		return NULL;
+	}
+	return Py_BuildValue("(NN)",at,ay);
+}
+
+static PyObject *Model_profile(Model *self, PyObject *unused)
+{
+	const double *P, *rho, *T;
+	int stride;
+	int n = crustcool_profile(self->cc,&P,&rho,&T,&stride);
+	if (n == 0) {
+		PyErr_SetString(PyExc_RuntimeError,"the model has not been set up");
+		return NULL;
+	}
+	PyObject *base = pin(self);
+	if (base == NULL) return NULL;
+	PyObject *aP = view(base,P,n,stride);
+	PyObject *arho = view(base,rho,n,stride);
+	PyObject *aT = view(base,T,n,stride);
+	Py_DECREF(base);
+	if (aP == NULL || arho == NULL || aT == NULL) {
+		Py_XDECREF(aP); Py_XDECREF(arho); Py_XDECREF(aT);
+		return NULL;
+	}
+	return Py_BuildValue("(NNN)",aP,arho,aT);
+}
+
+
+static PyMethodDef Model_methods[] = {
+	{"read", (PyCFunction) Model_read, METH_VARARGS, "read parameters from an init.dat file"},
+	{"set", (PyCFunction) Model_set, METH_VARARGS | METH_KEYWORDS, "set parameters, e.g. set(Tc=3e7)"},
+	{"setup", (PyCFunction) Model_setup, METH_NOARGS, "set up the grid, envelope and tables"},
+	{"evolve", (PyCFunction) Model_evolve, METH_NOARGS, "run the outburst and cooling; returns chi-squared"},
+	{"evolve_ensemble", (PyCFunction) Model_evolve_ensemble, METH_VARARGS | METH_KEYWORDS,
+		"evolve models with arrays of Qimp, Qinner, Tc, Tt, mdot together; returns chi-squared"},
+	{"chisq", (PyCFunction) Model_chisq, METH_NOARGS, "chi-squared from the last evolve"},
+	{"lightcurve", (PyCFunction) Model_lightcurve, METH_NOARGS, "(t, Teff) views of the model lightcurve"},
+	{"profile", (PyCFunction) Model_profile, METH_NOARGS, "(P, rho, T) views of the grid"},
+	{NULL}
+};
+
+static PyTypeObject ModelType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+};
+
+static PyModuleDef crustcool_module = {
+	PyModuleDef_HEAD_INIT, "crustcool", "Neutron star crust cooling models", -1, NULL
+};
+
+
+PyMODINIT_FUNC PyInit_crustcool(void)
+{
+	import_array();
+
+	ModelType.tp_name = "crustcool.Model";
+	ModelType.tp_basicsize = sizeof(Model);
+	ModelType.tp_flags = Py_TPFLAGS_DEFAULT;
+	ModelType.tp_doc = "A crust cooling model";
+	ModelType.tp_new = PyType_GenericNew;
+	ModelType.tp_init = (initproc) Model_init;
+	ModelType.tp_dealloc = (destructor) Model_dealloc;
+	ModelType.tp_methods = Model_methods;
+	if (PyType_Ready(&ModelType) < 0) return NULL;
+
+	PyObject *m = PyModule_Create(&crustcool_module);
+	if (m == NULL) return NULL;
+	Py_INCREF(&ModelType);
+	if (PyModule_AddObject(m,"Model",(PyObject *) &ModelType) < 0) {
+		Py_DECREF(&ModelType);
+		Py_DECREF(m);
+		return NULL;
+	}
+	return m;
+}
@@ -0,0 +1,515 @@
+// class ReducedModel
+//
+// POD-DEIM reduced model of the crust (see h/rom.h). The profile z = ln T over
+// the cells 1..N+1 is written as
+//     z = mean + Phi a
+// where the r columns of Phi are the leading eigenvectors of the covariance of
+// the training profiles (enough of them that the rest hold less than tol of the
+// variance, or rank of them). The heat equation is dz/dt = g(z), g = (dT/dt)/T,
+// and projecting it onto the modes gives da/dt = Phi^T g. g is interpolated
+// from its values at m cells chosen by the discrete empirical interpolation
+// method (Chaturantabut & Sorensen 2010, SIAM J. Sci. Comput. 32, 2737) from
+// the leading modes U of the training g, as g = U (P^T U)^-1 P^T g, so that
+//     da/dt = B g_p,  B = Phi^T U (P^T U)^-1
+// needs g only at the DEIM cells p. Crust::dTdt finds dT/dt at a cell from the
+// cell and its two neighbours, so each evaluation costs about 3m calls to
+// calculate_vars instead of N+1, and the integration has r unknowns instead of N+1.
+//
+// The outburst and the cooling are integrated as in Crust::evolve, with the
+// same integrator and output times, and a dense Jacobian from forward
+// differences.
+//
+// The file is text: a comment line, "n r m key", the mean, the modes (a row for
+// each cell), the DEIM cells, and B (a row for each mode). key is the table_key
+// of the crust it was built with, a hash of the grid and the microphysics
+// settings, so that it is only loaded into a Run with the same crust.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <algorithm>
+#include <gsl/gsl_eigen.h>
+#include "../h/rom.h"
+#include "../h/run.h"
+#include "../h/pool.h"
+#include "../h/timer.h"
+#include "../h/fail.h"
+
+// Ode_Int only has a relative tolerance, so the integrator works with a+offset,
+// which makes it an absolute tolerance of about offset*ode_eps in ln T
+static const double offset=100.0;
+
+ReducedModel::ReducedModel(Run &run) : owner(run)
+{
+	this->n=0;
+	this->r=0;
+	this->m=0;
+	this->nsave=0;
+}
+
+
+ReducedModel::~ReducedModel()
+{
+	this->ODE.tidy();
+}
+
+
+static void eigen(int n, std::vector<double> &C, std::vector<double> &evals, std::vector<double> &evecs)
+// eigenvalues of the symmetric matrix C[i*n+j] in decreasing order, and the
+// eigenvectors as the columns of evecs[i*n+k]
+{
+	gsl_matrix_view c=gsl_matrix_view_array(C.data(),n,n);
+	gsl_vector *eval=gsl_vector_alloc(n);
+	gsl_matrix *evec=gsl_matrix_alloc(n,n);
+	gsl_eigen_symmv_workspace *w=gsl_eigen_symmv_alloc(n);
+	gsl_eigen_symmv(&c.matrix,eval,evec,w);
+	gsl_eigen_symmv_free(w);
+	gsl_eigen_symmv_sort(eval,evec,GSL_EIGEN_SORT_VAL_DESC);
+	evals.resize(n);
+	evecs.resize(n*n);
+	for (int k=0; k<n; k++) {
+		evals[k]=gsl_vector_get(eval,k);
+		for (int i=0; i<n; i++) evecs[i*n+k]=gsl_matrix_get(evec,i,k);
+	}
+	gsl_vector_free(eval);
+	gsl_matrix_free(evec);
+}
+
+
+static int rank_for(std::vector<double> &evals, double tol)
+// the number of modes needed so that the rest hold less than tol of the variance
+{
+	int n=(int) evals.size();
+	double total=0.0;
+	for (int k=0; k<n; k++) if (evals[k] > 0.0) total+=evals[k];
+	double rest=total;
+	int k=0;
+	while (k < n && rest > tol*total) {
+		if (evals[k] > 0.0) rest-=evals[k];
+		k++;
+	}
+	return k > 0 ? k : 1;
+}
+
+
+static int solve(int n, std::vector<double> A, double *b)
+// solves A x = b (A[i*n+j]) by Gaussian elimination with partial pivoting,
+// leaving x in b; returns 0 if A is singular
+{
+	for (int k=0; k<n; k++) {
+		int p=k;
+		for (int i=k+1; i<n; i++) if (fabs(A[i*n+k]) > fabs(A[p*n+k])) p=i;
+		if (A[p*n+k] == 0.0) return 0;
+		if (p != k) {
+			for (int j=0; j<n; j++) std::swap(A[k*n+j],A[p*n+j]);
+			std::swap(b[k],b[p]);
+		}
+		for (int i=k+1; i<n; i++) {
+			double f=A[i*n+k]/A[k*n+k];
+			for (int j=k; j<n; j++) A[i*n+j]-=f*A[k*n+j];
+			b[i]-=f*b[k];
+		}
+	}
+	for (int k=n-1; k>=0; k--) {
+		for (int j=k+1; j<n; j++) b[k]-=A[k*n+j]*b[j];
+		b[k]/=A[k*n+k];
+	}
+	return 1;
+}
+
+
+void ReducedModel::build(std::vector<double> &z, std::vector<double> &g, int rank, double tol)
+// finds the modes, the DEIM cells and B from the snapshots of ln T and
+// d ln T/dt (n values for each, one snapshot after another)
+{
+	int n=this->n, ns=(int) z.size()/n;
+
+	// POD of the profiles
+	this->mean.assign(n,0.0);
+	for (int s=0; s<ns; s++) for (int i=0; i<n; i++) this->mean[i]+=z[s*n+i]/ns;
+	std::vector<double> C(n*n,0.0), evals, evecs, dz(n);
+	for (int s=0; s<ns; s++) {
+		for (int i=0; i<n; i++) dz[i]=z[s*n+i]-this->mean[i];
+		for (int i=0; i<n; i++) for (int j=0; j<=i; j++) C[i*n+j]+=dz[i]*dz[j];
+	}
+	for (int i=0; i<n; i++) for (int j=0; j<i; j++) C[j*n+i]=C[i*n+j];
+	eigen(n,C,evals,evecs);
+	this->r = (rank > 0) ? rank : rank_for(evals,tol);
+	if (this->r > n) this->r=n;
+	int r=this->r;
+	this->phi.resize(n*r);
+	for (int i=0; i<n; i++) for (int k=0; k<r; k++) this->phi[i*r+k]=evecs[i*n+k];
+
+	// POD of d ln T/dt, with each snapshot normalized so that the fast early
+	// part of each phase doesn't swamp the rest
+	C.assign(n*n,0.0);
+	for (int s=0; s<ns; s++) {
+		double norm=0.0;
+		for (int i=0; i<n; i++) norm+=g[s*n+i]*g[s*n+i];
+		if (!(norm > 0.0) || !isfinite(norm)) continue;
+		norm=1.0/sqrt(norm);
+		for (int i=0; i<n; i++) for (int j=0; j<=i; j++) C[i*n+j]+=g[s*n+i]*g[s*n+j]*norm*norm;
+	}
+	for (int i=0; i<n; i++) for (int j=0; j<i; j++) C[j*n+i]=C[i*n+j];
+	eigen(n,C,evals,evecs);
+	this->m=rank_for(evals,tol);
+	if (this->m < r) this->m=r;
+	int m=this->m;
+
+	// DEIM: each cell is where the next mode is worst interpolated from the
+	// cells so far
+	this->cells.resize(m);
+	std::vector<double> A, c;
+	for (int l=0; l<m; l++) {
+		std::vector<double> res(n);
+		for (int i=0; i<n; i++) res[i]=evecs[i*n+l];
+		if (l > 0) {
+			A.resize(l*l);
+			c.resize(l);
+			for (int a=0; a<l; a++) {
+				for (int b=0; b<l; b++) A[a*l+b]=evecs[(this->cells[a]-1)*n+b];
+				c[a]=evecs[(this->cells[a]-1)*n+l];
+			}
+			if (solve(l,A,c.data()))
+				for (int i=0; i<n; i++) for (int b=0; b<l; b++) res[i]-=evecs[i*n+b]*c[b];
+		}
+		int p=0;
+		for (int i=1; i<n; i++) if (fabs(res[i]) > fabs(res[p])) p=i;
+		this->cells[l]=p+1;
+	}
+
+	// B = W M^-1 with W = Phi^T U and M = P^T U, a row at a time from M^T B_k = W_k
+	std::vector<double> MT(m*m);
+	for (int a=0; a<m; a++) for (int b=0; b<m; b++) MT[b*m+a]=evecs[(this->cells[a]-1)*n+b];
+	this->B.resize(r*m);
+	for (int k=0; k<r; k++) {
+		for (int l=0; l<m; l++) {
+			double w=0.0;
+			for (int i=0; i<n; i++) w+=this->phi[i*r+k]*evecs[i*n+l];
+			this->B[k*m+l]=w;
+		}
+		if (!solve(m,MT,&this->B[k*m])) {
+			printf("The DEIM cells are degenerate; try fewer modes\n");
+			exit(1);
+		}
+	}
+	prepare();
+}
+
+
+void ReducedModel::prepare(void)
+// the stencil and the integrator for the current modes and cells
+{
+	std::vector<char> used(this->n+2,0);
+	for (int l=0; l<this->m; l++)
+		for (int i=this->cells[l]-1; i<=this->cells[l]+1; i++)
+			if (i >= 1 && i <= this->n) used[i]=1;
+	this->stencil.clear();
+	for (int i=1; i<=this->n; i++) if (used[i]) this->stencil.push_back(i);
+	this->T.assign(this->n+1,0.0);
+	this->a.resize(this->r);
+	this->g.resize(this->m);
+	this->f1.resize(this->r+1);
+	this->ODE.init(this->r,this);
+}
+
+
+void ReducedModel::save(const char *fname)
+{
+	FILE *fp = fopen(fname,"w");
+	if (fp == NULL) {
+		printf("Could not open %s\n", fname);
+		exit(1);
+	}
+	int n=this->n, r=this->r, m=this->m;
+	fprintf(fp,"# crustcool reduced model\n%d %d %d %016llx\n", n, r, m, this->owner.crust.table_key());
+	for (int i=0; i<n; i++) fprintf(fp,"%.17g ",this->mean[i]);
+	fprintf(fp,"\n");
+	for (int i=0; i<n; i++) {
+		for (int k=0; k<r; k++) fprintf(fp,"%.17g ",this->phi[i*r+k]);
+		fprintf(fp,"\n");
+	}
+	for (int l=0; l<m; l++) fprintf(fp,"%d ",this->cells[l]);
+	fprintf(fp,"\n");
+	for (int k=0; k<r; k++) {
+		for (int l=0; l<m; l++) fprintf(fp,"%.17g ",this->B[k*m+l]);
+		fprintf(fp,"\n");
+	}
+	fclose(fp);
+}
+
+
+int ReducedModel::load(const char *fname)
+// reads a model written by save; returns 0 if it can't be read or is for another grid
+{
+	FILE *fp = fopen(fname,"r");
+	if (fp == NULL) {
+		printf("Could not open %s\n", fname);
+		return 0;
+	}
+	char s[200];
+	int n, r, m, ok=1;
+	unsigned long long key;
+	if (fgets(s,200,fp) == NULL || fscanf(fp,"%d %d %d %llx",&n,&r,&m,&key) != 4 || n < 1 || r < 1 || m < 1) ok=0;
+	if (ok) {
+		this->mean.resize(n);
+		this->phi.resize(n*r);
+		this->cells.resize(m);
+		this->B.resize(r*m);
+		for (int i=0; ok && i<n; i++) if (fscanf(fp,"%lg",&this->mean[i]) != 1) ok=0;
+		for (int j=0; ok && j<n*r; j++) if (fscanf(fp,"%lg",&this->phi[j]) != 1) ok=0;
+		for (int l=0; ok && l<m; l++) if (fscanf(fp,"%d",&this->cells[l]) != 1 || this->cells[l] < 1 || this->cells[l] > n) ok=0;
+		for (int j=0; ok && j<r*m; j++) if (fscanf(fp,"%lg",&this->B[j]) != 1) ok=0;
+	}
+	fclose(fp);
+	if (!ok) {
+		printf("Could not read the reduced model in %s\n", fname);
+		return 0;
+	}
+	if (n != this->owner.crust.N+1) {
+		printf("The reduced model in %s is for %d cells, but the grid has %d\n", fname, n, this->owner.crust.N+1);
+		return 0;
+	}
+	if (key != this->owner.crust.table_key()) {
+		printf("The reduced model in %s was built for a different grid or crust settings\n", fname);
+		return 0;
+	}
+	this->n=n;
+	this->r=r;
+	this->m=m;
+	prepare();
+	return 1;
+}
+
+
+void ReducedModel::expand(const double *a, int all)
+// sets T from the coefficients a[0..r-1], in every cell or (if all is 0) only in the stencil
+{
+	int r=this->r;
+	int ncells = all ? this->n : (int) this->stencil.size();
+	for (int j=0; j<ncells; j++) {
+		int i = all ? j+1 : this->stencil[j];
+		const double *p=&this->phi[(i-1)*r];
+		double z=this->mean[i-1];
+		for (int k=0; k<r; k++) z+=p[k]*a[k];
+		this->T[i]=exp(z);
+	}
+}
+
+
+void ReducedModel::derivs(double t, double y[], double dydt[])
+{
+	Crust &crust=this->owner.crust;
+	int r=this->r, m=this->m;
+	double *a=this->a.data();
+	for (int k=0; k<r; k++) a[k]=y[k+1]-offset;
+	expand(a,0);
+	for (int l=0; l<m; l++) {
+		int i=this->cells[l];
+		this->g[l]=crust.dTdt(i,this->T.data())/this->T[i];
+	}
+	for (int k=0; k<r; k++) {
+		double s=0.0;
+		for (int l=0; l<m; l++) s+=this->B[k*m+l]*this->g[l];
+		dydt[k+1]=s;
+	}
+}
+
+
+void ReducedModel::jacobn(double t, double *y, double *dydt, double **dfdy, int n)
+// forward differences, with dfdy[j][i] the derivative of dy_i/dt with respect
+// to y_j (the order that Ode_Int passes to GSL)
+{
+	double e=1e-6;
+	for (int j=1; j<=n; j++) {
+		double y0=y[j];
+		y[j]+=e;
+		derivs(t,y,this->f1.data());
+		y[j]=y0;
+		for (int i=1; i<=n; i++) dfdy[j][i]=(this->f1[i]-dydt[i])/e;
+	}
+}
+
+
+void ReducedModel::evolve(double timetorun, double mdot, std::vector<double> &a, int record)
+// as Crust::evolve: timetorun days (at infinity) at accretion rate mdot, from
+// the coefficients a, which are left at the end; the lightcurve is saved if
+// record is set
+{
+	Crust &crust=this->owner.crust;
+	crust.outburst_duration=timetorun/(365.0*crust.ZZ);
+	crust.heating = (mdot > 0.0);
+	crust.mdot=mdot;
+	crust.precalculate_vars();
+	crust.force_precalc=0;
+
+	double duration=crust.outburst_duration*3.15e7;
+	for (int k=0; k<this->r; k++) this->ODE.set_bc(k+1,a[k]+offset);
+	this->ODE.go(0.0,duration,duration*0.01,crust.ode_eps);
+	int kount=this->ODE.kount;
+	for (int k=0; k<this->r; k++) a[k]=this->ODE.get_y(k+1,kount)-offset;
+
+	if (record) {
+		this->nsave=kount;
+		this->tsave.resize(kount+1);
+		this->Tsave.resize(kount+1);
+		for (int j=1; j<=kount; j++) {
+			double z=this->mean[0];
+			for (int k=0; k<this->r; k++) z+=this->phi[k]*(this->ODE.get_y(k+1,j)-offset);
+			this->tsave[j]=this->ODE.get_x(j);
+			this->Tsave[j]=exp(z);
+		}
+	}
+}
+
+
+void ReducedModel::run(void)
+// the outburst and then the cooling, from the core temperature, leaving the
+// lightcurve of the last phase in tsave and Tsave and the final profile in the grid
+{
+	Run &run=this->owner;
+	Crust &crust=run.crust;
+	if (run.use_piecewise || crust.resume)
+		fail("The reduced model starts from the core temperature, so it can't be used with piecewise or resume");
+	double mdot=crust.mdot, outburst_duration=crust.outburst_duration;
+	crust.reset();
+
+	// project the starting profile onto the modes
+	std::vector<double> a(this->r,0.0);
+	for (int i=1; i<=this->n; i++) {
+		double dz=log(crust.grid[i].T)-this->mean[i-1];
+		for (int k=0; k<this->r; k++) a[k]+=this->phi[(i-1)*this->r+k]*dz;
+	}
+
+	int cooling = run.time_to_run > 0.0;
+	evolve(outburst_duration*365.0,mdot,a,!cooling);
+	if (cooling) evolve(run.time_to_run,0.0,a,1);
+
+	expand(a.data(),1);
+	for (int i=1; i<=this->n; i++) crust.grid[i].T=this->T[i];
+	crust.mdot=mdot;
+	crust.outburst_duration=outburst_duration;
+}
+
+
+void ReducedModel::snapshots(Crust &crust, std::vector<double> &z, std::vector<double> &g)
+// appends ln T and d ln T/dt at every step of the crust's last evolve (with the
+// heating of that evolve still set)
+{
+	int n=crust.N+1;
+	std::vector<double> T(n+1), f(n+1);
+	for (int j=1; j<=crust.ODE.kount; j++) {
+		for (int i=1; i<=n; i++) T[i]=crust.ODE.get_y(i,j);
+		crust.derivs(crust.ODE.get_x(j),T.data(),f.data());
+		for (int i=1; i<=n; i++) {
+			z.push_back(log(T[i]));
+			g.push_back(f[i]/T[i]);
+		}
+	}
+}
+
+
+void run_rom(Run &base, const char *fname, int nthreads, int ntrain, int rank, unsigned long seed)
+{
+	// results go to stdout, so move everything else to stderr
+	fflush(stdout);
+	FILE *out = fdopen(dup(1),"w");
+	dup2(2,1);
+
+	// the training runs are all full models, without output files
+	base.set_string_parameter("rom","");
+	base.output_heating=0;
+	base.output_cooling=0;
+	base.crust.output=0;
+	if (base.needs_setup) base.setup();
+	if (base.use_piecewise || base.crust.resume) {
+		printf("The reduced model starts from the core temperature, so it can't be used with piecewise or resume\n");
+		exit(1);
+	}
+
+	int ndim=(int) base.priors.size();
+	if (ndim == 0) ntrain=1;
+	else if (ntrain <= 0) ntrain=10*ndim;
+	std::vector<double> u(ntrain*ndim), x(ntrain*ndim);
+	if (ndim > 0) latin_hypercube(ntrain,base.priors,seed,u.data(),x.data());
+
+	double start=wall_time();
+	fprintf(out,"Running %d models over %d parameters\n", ntrain, ndim);
+	fflush(out);
+	std::vector< std::vector<double> > z(ntrain), g(ntrain);
+	std::vector<char> same(ntrain,1);
+	std::vector<Run *> workers(nthreads,(Run *) NULL);
+	{
+		ThreadPool pool(nthreads);
+		for (int k=0; k<ntrain; k++) {
+			pool.submit([&,k](int w) {
+				if (workers[w] == NULL) workers[w] = new Run;
+				Run *run=workers[w];
+				run->copy_parameters(base);
+				for (int d=0; d<ndim; d++) {
+					Prior &p=base.priors[d];
+					double xd=x[k*ndim+d];
+					run->set_parameter(p.name,p.log ? pow(10.0,xd) : xd);
+				}
+				run->output_heating=0;
+				run->output_cooling=0;
+				run->crust.output=0;
+				// the reduced model is for one grid
+				if (!run->same_setup(base)) {
+					same[k]=0;
+					return;
+				}
+				if (run->needs_setup) run->setup_from(base);
+				Crust &crust=run->crust;
+				double mdot=crust.mdot, outburst_duration=crust.outburst_duration;
+				crust.reset();
+				crust.evolve(outburst_duration*365.0,mdot);
+				ReducedModel::snapshots(crust,z[k],g[k]);
+				if (run->time_to_run > 0.0) {
+					crust.evolve(run->time_to_run,0.0);
+					ReducedModel::snapshots(crust,z[k],g[k]);
+				}
+				crust.mdot=mdot;
+				crust.outburst_duration=outburst_duration;
+				run->invalidate(STAGE_HEATING);
+			});
+		}
+		pool.wait();
+	}
+	for (int w=0; w<nthreads; w++) delete workers[w];
+	for (int k=0; k<ntrain; k++) {
+		if (!same[k]) {
+			printf("The priors change the grid, tables or envelope, but the reduced model is for one setup\n");
+			exit(1);
+		}
+	}
+	double trun=wall_time()-start;
+
+	std::vector<double> zall, gall;
+	for (int k=0; k<ntrain; k++) {
+		zall.insert(zall.end(),z[k].begin(),z[k].end());
+		gall.insert(gall.end(),g[k].begin(),g[k].end());
+	}
+	ReducedModel rom(base);
+	rom.n=base.crust.N+1;
+	rom.build(zall,gall,rank,1e-8);
+	rom.save(fname);
+	fprintf(out,"Built from %d profiles (%lg s) in %lg s: %d modes and %d DEIM cells for %d cells\n",
+		(int) zall.size()/rom.n, trun, wall_time()-start-trun, rom.r, rom.m, rom.n);
+
+	// compare with the full model at the parameters in init.dat
+	double t0=wall_time();
+	base.invalidate(STAGE_HEATING);
+	double chisq=base.run();
+	double t1=wall_time();
+	rom.run();
+	double chisq_rom=base.data.calculate_chisq(base.crust,rom.nsave,rom.tsave.data(),rom.Tsave.data());
+	double t2=wall_time();
+	base.invalidate(STAGE_HEATING);
+	fprintf(out,"At the parameters in init.dat: chisq %lg (%lg s) with the full model, %lg (%lg s) with the reduced one\n",
+		chisq, t1-t0, chisq_rom, t2-t1);
+	fclose(out);
+}
@@ -4,15 +4,16 @@
 #include <gsl/gsl_errno.h>
 #include <gsl/gsl_roots.h>
 
-double zbrent(double (*func)(double), double x1, double x2, double tol)
+double zbrent(double (*func)(double, void *), void *params, double x1, double x2, double tol)
 // Follows example at https://www.gnu.org/software/gsl/manual/html_node/Root-Finding-Examples.html#Root-Finding-Examples
+// params is passed through to func, e.g. a pointer to the object whose member function
+// we want the root of, so there is no need for a global pointer
 {
 	gsl_root_fsolver *s;
 	int iter = 0, max_iter = 100, status;
 	gsl_function F;
-	// in the next line, cast the function to take an extra void* argument
-	// as needed by GSL. 
-	F.function = (double (*)(double,void*)) func;
+	F.function = func;
+	F.params = params;
 	s = gsl_root_fsolver_alloc(gsl_root_fsolver_brent);
 	gsl_root_fsolver_set (s, &F, x1, x2);
 	
@@ -24,6 +25,7 @@ double zbrent(double (*func)(double), double x1, double x2, double tol)
 		status = gsl_root_test_interval (x1, x2, 0.0, tol);
 	} while (status == GSL_CONTINUE && iter < max_iter);
 	
+	double root = gsl_root_fsolver_root(s);
 	gsl_root_fsolver_free (s);
-	return gsl_root_fsolver_root(s);
+	return root;
 }
@@ -0,0 +1,592 @@
+// class Run
+//
+// Reads the parameters for a model from an init.dat file (or has them set
+// one at a time), sets up the crust, and then runs the outburst and the
+// cooling and calculates chi-squared against the data.
+//
+// Once set up, run() can be called repeatedly, and it only redoes the stages
+// whose inputs have changed since the last run: the setup (grid, tables and
+// envelope), the outburst, the cooling, and chi-squared. Changing Lscale only
+// recalculates chi-squared from the last lightcurve, and changing timetorun
+// restarts the cooling from the temperature profile saved at the end of the
+// outburst. The parameters are listed in a table in the constructor, which
+// gives their names in init.dat and the first stage that depends on them.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <gsl/gsl_rng.h>
+#include <gsl/gsl_randist.h>
+#include "../h/run.h"
+#include "../h/heatcache.h"
+#include "../h/rom.h"
+#include "../h/fail.h"
+
+Run::Run()
+{
+	strcpy(this->sourcename,"1659");
+	this->time_to_run=1e4;
+	this->use_piecewise=0;
+	this->output_heating=0;
+	this->output_cooling=1;
+	this->cache_outburst=64;
+	this->cache_disk=0;
+	this->emulator[0]='\0';
+	this->emu_tol=1.0;
+	this->rom_file[0]='\0';
+	this->rom=NULL;
+	this->chisq=0.0;
+	this->heated_time=0.0;
+	this->heated_last_output=0.0;
+	this->nvec=1;
+	this->rhovec[0]=0.0; this->Tvec[0]=0.0;
+
+	// the names used in init.dat, and the first stage that depends on the parameter
+	this->nparams=0;
+	add_parameter("Bfield",&this->crust.B,STAGE_TABLES);
+	add_parameter("Tc",&this->crust.Tc,STAGE_HEATING);
+	add_parameter("Tt",&this->crust.Tt,STAGE_HEATING);
+	add_parameter("SFgap",&this->crust.gap,STAGE_TABLES);
+	add_parameter("ngrid",&this->crust.N,STAGE_GRID);
+	add_parameter("kncrit",&this->crust.kncrit,STAGE_TABLES);
+	add_parameter("mdot",&this->crust.mdot,STAGE_HEATING);
+	add_parameter("mass",&this->crust.mass,STAGE_GRID);
+	add_parameter("C_core",&this->crust.C_core,STAGE_TABLES);
+	add_parameter("Lnu_core_alpha",&this->crust.Lnu_core_alpha,STAGE_TABLES);
+	add_parameter("Lnu_core_norm",&this->crust.Lnu_core_norm,STAGE_TABLES);
+	add_parameter("gpe",&this->crust.gpe,STAGE_ENVELOPE);
+	add_parameter("radius",&this->crust.radius,STAGE_GRID);
+	add_parameter("Edep",&this->crust.energy_deposited_outer,STAGE_HEATING);
+	add_parameter("ytop",&this->crust.yt,STAGE_GRID);
+	add_parameter("Einner",&this->crust.energy_deposited_inner,STAGE_HEATING);
+	add_parameter("resume",&this->crust.resume,STAGE_HEATING);
+	add_parameter("Qimp",&this->crust.Qimp,STAGE_HEATING);
+	add_parameter("Qrho",&this->crust.Qrho,STAGE_HEATING);
+	add_parameter("rhob",&this->crust.rhob,STAGE_HEATING);
+	add_parameter("rhot",&this->crust.rhot,STAGE_HEATING);
+	add_parameter("precalc",&this->crust.force_precalc,0);
+	add_parameter("shared_tables",&this->crust.shared_tables,0);
+	add_parameter("nbeta",&this->crust.table_nbeta,STAGE_TABLES);
+	add_parameter("ode_eps",&this->crust.ode_eps,STAGE_HEATING);
+	add_parameter("Qinner",&this->crust.Qinner,STAGE_HEATING);
+	add_parameter("output_cooling",&this->output_cooling,STAGE_COOLING);
+	add_parameter("output_heating",&this->output_heating,STAGE_HEATING);
+	add_parameter("timetorun",&this->time_to_run,STAGE_COOLING);
+	add_parameter("toutburst",&this->crust.outburst_duration,STAGE_HEATING);
+	add_parameter("piecewise",&this->use_piecewise,STAGE_HEATING);
+	add_parameter("neutrinos",&this->crust.nuflag,STAGE_HEATING);
+	add_parameter("accreted",&this->crust.accr,STAGE_GRID);
+	add_parameter("angle_mu",&this->crust.angle_mu,STAGE_ENVELOPE);
+	add_parameter("cooling_bc",&this->crust.force_cooling_bc,STAGE_HEATING);
+	add_parameter("extra_heating",&this->crust.extra_heating,STAGE_HEATING);
+	add_parameter("deep_heating_factor",&this->crust.deep_heating_factor,STAGE_HEATING);
+	add_parameter("energy_slope",&this->crust.energy_slope,STAGE_HEATING);
+	add_parameter("potek_eos",&this->crust.use_potek_eos,STAGE_TABLES);
+	add_parameter("envelope",&this->crust.use_my_envelope,STAGE_ENVELOPE);
+	add_parameter("ylight",&this->crust.ylight,STAGE_ENVELOPE);
+	add_parameter("extra_Q",&this->crust.extra_Q,STAGE_HEATING);
+	add_parameter("extra_y",&this->crust.extra_y,STAGE_HEATING);
+	add_parameter("Lscale",&this->crust.Lscale,STAGE_CHISQ);
+	add_parameter("Lmin",&this->crust.Lmin,STAGE_CHISQ);
+	add_parameter("profile_L",&this->data.profile_L,STAGE_CHISQ);
+	add_parameter("cache_outburst",&this->cache_outburst,0);
+	add_parameter("cache_disk",&this->cache_disk,0);
+	add_parameter("emu_tol",&this->emu_tol,0);
+	mark_done();
+	invalidate(STAGE_SETUP|STAGE_HEATING|STAGE_COOLING|STAGE_DATA|STAGE_CHISQ);
+}
+
+
+Run::~Run()
+{
+	delete this->rom;
+}
+
+
+void Run::add_parameter(const char *name, double *d, int stage)
+{
+	Parameter *p = &this->params[this->nparams++];
+	p->name=name; p->d=d; p->i=NULL; p->stage=stage;
+}
+
+void Run::add_parameter(const char *name, int *i, int stage)
+{
+	Parameter *p = &this->params[this->nparams++];
+	p->name=name; p->d=NULL; p->i=i; p->stage=stage;
+}
+
+
+static int following_stages(int stages)
+// the stages along with the stages that follow them
+{
+	if (stages & STAGE_SETUP) stages |= STAGE_HEATING|STAGE_DATA;
+	if (stages & STAGE_HEATING) stages |= STAGE_COOLING;
+	if (stages & (STAGE_COOLING|STAGE_DATA)) stages |= STAGE_CHISQ;
+	return stages;
+}
+
+
+void Run::invalidate(int stages)
+// marks stages to be done again by the next run, along with the stages that follow
+// them, whether or not any parameters change
+{
+	this->forced |= following_stages(stages);
+	update_dirty();
+}
+
+
+void Run::update_dirty(void)
+// works out the stages to be done again from the parameters that differ from
+// those of the last run. Comparing the final values, rather than marking each
+// change as it is made, means that setting a parameter and then setting it back
+// (as the samplers do by copying the base parameters before the sampled ones)
+// doesn't cost anything.
+{
+	int stages=this->forced;
+	for (int k=0; k<this->nparams; k++) {
+		Parameter *p = &this->params[k];
+		double x = get(p);
+		if (x != this->last[k]) stages |= p->stage;
+		// the sign of Qimp chooses between the supplied Q and the crust model
+		if (!strcmp(p->name,"Qimp") && (x >= 0.0) != (this->last[k] >= 0.0)) stages |= STAGE_GRID;
+	}
+	if (strcmp(this->sourcename,this->last_source)) stages |= STAGE_DATA;
+	if (strcmp(this->crust.envelope_library,this->last_envlib)) stages |= STAGE_ENVELOPE;
+	if (strcmp(this->rom_file,this->last_rom)) stages |= STAGE_HEATING;
+	if (this->nvec != this->last_nvec) stages |= STAGE_HEATING;
+	else for (int i=0; i<this->nvec; i++)
+		if (this->rhovec[i] != this->last_rhovec[i] || this->Tvec[i] != this->last_Tvec[i]) stages |= STAGE_HEATING;
+	this->dirty=following_stages(stages);
+	this->needs_setup = (this->dirty & STAGE_SETUP) != 0;
+}
+
+
+void Run::mark_done(void)
+// records the parameters as those of the last run, with nothing left to do
+{
+	for (int k=0; k<this->nparams; k++) this->last[k]=get(&this->params[k]);
+	strcpy(this->last_source,this->sourcename);
+	strcpy(this->last_envlib,this->crust.envelope_library);
+	strcpy(this->last_rom,this->rom_file);
+	this->last_nvec=this->nvec;
+	for (int i=0; i<this->nvec; i++) {
+		this->last_rhovec[i]=this->rhovec[i];
+		this->last_Tvec[i]=this->Tvec[i];
+	}
+	this->forced=0;
+	this->dirty=0;
+	this->needs_setup=0;
+}
+
+
+int Run::read_parameters(const char *fname)
+// reads the parameters from an init.dat file; returns 0 if the file could not be opened
+{
+	FILE *fp = fopen(fname,"r");
+	if (fp == NULL) {
+		printf("Could not open %s\n", fname);
+		return 0;
+	}
+	fclose(fp);
+	parse_file(fname);
+	read_piecewise_profile(fname);
+	update_dirty();
+	return 1;
+}
+
+
+void Run::parse_file(const char *fname)
+{
+ 	// Set parameters
+	printf("Reading input data from %s\n",fname);
+	FILE *fp = fopen(fname,"r");
+	if (fp == NULL) {
+		printf("Could not open %s\n", fname);
+		return;
+	}
+	char s[200];
+	char s1[200];
+	char s2[200];
+	char includename[200];
+	double x;
+	int commented=0;
+	while (fgets(s1,200,fp) != NULL) {   // we read the file line by line
+		// ignoring lines that begin with \n (blank) or with # (comments)
+		// or with $ (temperature profile)
+		if (!strncmp(s1,"##",2)) commented = 1-commented;
+		if (!strncmp(s1,"<",1)) {   // include another init file
+			sscanf(s1,"%s\t%s\n",s,s2);
+			sprintf(includename,"init/init.dat.%s",s2);
+			parse_file(includename);
+		}
+		if (strncmp(s1,"#",1) && strncmp(s1,"\n",1) && strncmp(s1,">",1) && commented==0) {
+			if (!strncmp(s1,"source",6) || !strncmp(s1,"envlib",6) || !strncmp(s1,"emulator",8)
+				|| !strncmp(s1,"rom",3)) {
+				sscanf(s1,"%s\t%s\n",s,s2);
+				set_string_parameter(s,s2);
+			} else if (!strncmp(s1,"prior",5)) {
+				read_prior(s1);
+			} else if (!strncmp(s1,"cheap",5)) {
+				read_cheap(s1);
+			} else {
+				sscanf(s1,"%s\t%lg\n",s,&x);
+				set_parameter(s,x);
+			}
+		}
+	}
+
+	fclose(fp);
+}
+
+
+void Run::read_prior(const char *line)
+// "prior <name> <min> <max> [log]"; a later line for the same parameter replaces an earlier one
+{
+	Prior p;
+	char scale[20]="";
+	if (sscanf(line,"%*s %63s %lg %lg %19s",p.name,&p.min,&p.max,scale) < 3 || p.max <= p.min) {
+		fail("Could not read the prior: %.*s", (int) strcspn(line,"\n"), line);
+	}
+	p.log = !strcmp(scale,"log");
+	Run check;
+	if (!check.set_parameter(p.name,0.0)) {
+		fail("Unknown parameter in the prior: %.*s", (int) strcspn(line,"\n"), line);
+	}
+	for (int k=0; k<(int) this->priors.size(); k++) {
+		if (!strcmp(this->priors[k].name,p.name)) {
+			this->priors[k]=p;
+			return;
+		}
+	}
+	this->priors.push_back(p);
+}
+
+
+void Run::read_cheap(const char *line)
+// "cheap <name> <value>"
+{
+	Override o;
+	if (sscanf(line,"%*s %63s %lg",o.name,&o.value) != 2) {
+		fail("Could not read the cheap model setting: %.*s", (int) strcspn(line,"\n"), line);
+	}
+	Run check;
+	if (!check.set_parameter(o.name,0.0)) {
+		fail("Unknown parameter in the cheap model setting: %.*s", (int) strcspn(line,"\n"), line);
+	}
+	this->cheap.push_back(o);
+}
+
+
+int Run::set_parameter(const char *s, double x)
+// sets a numerical parameter using the names in init.dat; returns 0 if the name is not recognized
+{
+	int found=0;
+
+	// as in init.dat, a name matches every parameter that it starts with
+	for (int k=0; k<this->nparams; k++) {
+		Parameter *p = &this->params[k];
+		if (strncmp(s,p->name,strlen(p->name))) continue;
+		if (p->d != NULL) *p->d=x; else *p->i=(int) x;
+		found=1;
+	}
+	if (found) update_dirty();
+	return found;
+}
+
+
+double Run::get_parameter(const char *s)
+// the value of a numerical parameter (0 if the name is not recognized)
+{
+	for (int k=0; k<this->nparams; k++)
+		if (!strncmp(s,this->params[k].name,strlen(this->params[k].name))) return get(&this->params[k]);
+	return 0.0;
+}
+
+
+double Run::get(Parameter *p)
+{
+	if (p->d != NULL) return *p->d;
+	return (double) *p->i;
+}
+
+
+static unsigned long long hash_bytes(unsigned long long h, const void *p, size_t n)
+// FNV-1a
+{
+	const unsigned char *c = (const unsigned char *) p;
+	for (size_t k=0; k<n; k++) {
+		h ^= c[k];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+
+unsigned long long Run::heating_key(void)
+// a hash of the parameters that the outburst depends on, i.e. those of the
+// setup and heating stages, for the heating cache
+{
+	unsigned long long h=14695981039346656037ULL;
+	for (int k=0; k<this->nparams; k++) {
+		if (!(this->params[k].stage & (STAGE_SETUP|STAGE_HEATING))) continue;
+		double x = get(&this->params[k]);
+		h=hash_bytes(h,this->params[k].name,strlen(this->params[k].name));
+		h=hash_bytes(h,&x,sizeof(double));
+	}
+	h=hash_bytes(h,this->crust.envelope_library,strlen(this->crust.envelope_library));
+	return h;
+}
+
+
+void Run::copy_parameters(Run &from)
+// sets all the parameters to the values in another run
+{
+	for (int k=0; k<this->nparams; k++) {
+		Parameter *p = &this->params[k];
+		double x = get(&from.params[k]);
+		if (p->d != NULL) *p->d=x; else *p->i=(int) x;
+	}
+	set_string_parameter("source",from.sourcename);
+	set_string_parameter("envlib",from.crust.envelope_library);
+	set_string_parameter("emulator",from.emulator);
+	set_string_parameter("rom",from.rom_file);
+	this->nvec=from.nvec;
+	for (int i=0; i<from.nvec; i++) {
+		this->rhovec[i]=from.rhovec[i];
+		this->Tvec[i]=from.Tvec[i];
+	}
+	update_dirty();
+}
+
+
+int Run::same_setup(Run &other)
+// returns 1 if the two runs have the same grid, envelope and tables
+{
+	for (int k=0; k<this->nparams; k++)
+		if ((this->params[k].stage & STAGE_SETUP) && get(&this->params[k]) != get(&other.params[k])) return 0;
+	return (this->crust.Qimp >= 0.0) == (other.crust.Qimp >= 0.0)
+		&& !strcmp(this->sourcename,other.sourcename)
+		&& !strcmp(this->crust.envelope_library,other.crust.envelope_library);
+}
+
+
+int Run::set_string_parameter(const char *s, const char *value)
+// sets the parameters that are names rather than numbers
+{
+	if (!strncmp(s,"source",6)) {
+		strcpy(this->sourcename,value);
+		update_dirty();
+		return 1;
+	}
+	if (!strncmp(s,"envlib",6)) {
+		strcpy(this->crust.envelope_library,value);
+		update_dirty();
+		return 1;
+	}
+	if (!strncmp(s,"emulator",8)) {
+		strcpy(this->emulator,value);
+		return 1;
+	}
+	if (!strncmp(s,"rom",3)) {
+		if (strcmp(this->rom_file,value)) {
+			delete this->rom;
+			this->rom=NULL;
+		}
+		strcpy(this->rom_file,value);
+		update_dirty();
+		return 1;
+	}
+	return 0;
+}
+
+
+void Run::read_piecewise_profile(const char *fname)
+// reads the initial temperature profile from the lines marked ">" in init.dat
+{
+	FILE *fp = fopen(fname,"r");
+	if (fp == NULL) return;
+	char s1[200];  // string to hold each line of the file
+	int commented=0;
+	int i=1;
+	while (fgets(s1,200,fp) != NULL && i < 100) {
+		double rho, T,T2=0.0;
+		if (!strncmp(s1,"##",2)) commented = 1-commented;
+		if (!strncmp(s1,">",1) && commented==0) {
+			int nvar = sscanf(s1,">%lg\t%lg\t%lg\n",&rho,&T,&T2);
+			this->rhovec[i] = rho;
+			this->Tvec[i] = T;
+			i++;
+			if (nvar == 3) {
+				this->rhovec[i] = rho*1.01;
+				this->Tvec[i] = T2;
+				i++;
+			}
+		}
+	}
+	fclose(fp);
+	if (i > 1) this->nvec=i;
+}
+
+
+void Run::set_piecewise_profile(double *rho, double *T, int n)
+// sets the initial temperature profile from n (density, temperature) pairs,
+// with the same conventions as the ">" lines in init.dat
+{
+	if (n > 100) n=100;
+	for (int i=0; i<n; i++) {
+		this->rhovec[i+1]=rho[i];
+		this->Tvec[i+1]=T[i];
+	}
+	this->nvec=n+1;
+	this->use_piecewise=1;
+	update_dirty();
+}
+
+
+void Run::setup(void)
+{
+	printf("============================================\n");
+	this->crust.setup();
+	this->data.read_in_data(this->sourcename);
+	delete this->rom;    // (the grid may have changed)
+	this->rom=NULL;
+	mark_done();
+	invalidate(STAGE_HEATING);
+}
+
+
+void Run::setup_from(Run &base)
+// sets up by using the crust model of another run with the same setup (see
+// same_setup), which only costs the allocation of the state for one run
+{
+	this->crust.use_model(base.crust.model);
+	this->data.read_in_data(this->sourcename);
+	delete this->rom;
+	this->rom=NULL;
+	mark_done();
+	invalidate(STAGE_HEATING);
+}
+
+
+double Run::run(void)
+// runs the outburst and the cooling, and returns chi-squared; only the stages
+// that are out of date are done again
+{
+	if (this->needs_setup) setup();
+	if (this->dirty & STAGE_DATA) this->data.read_in_data(this->sourcename);
+
+	// a reduced model (see rom.cc) stands in for the outburst and the cooling
+	if (this->rom_file[0] != '\0') {
+		if (this->rom == NULL) {
+			ReducedModel *rom = new ReducedModel(*this);
+			if (!rom->load(this->rom_file)) {
+				delete rom;
+				fail("Could not load the reduced model in %s", this->rom_file);
+			}
+			this->rom=rom;
+			invalidate(STAGE_HEATING);
+		}
+		if (this->dirty & (STAGE_HEATING|STAGE_COOLING)) this->rom->run();
+		if (this->dirty & STAGE_CHISQ)
+			this->chisq = this->data.calculate_chisq(this->crust,this->rom->nsave,this->rom->tsave.data(),this->rom->Tsave.data());
+		mark_done();
+		return this->chisq;
+	}
+
+	// evolve overwrites these, but they are parameters for the next run
+	double mdot=this->crust.mdot, outburst_duration=this->crust.outburst_duration;
+
+	// the cooling is restarted from the end of the outburst, unless there is no
+	// cooling (chi-squared then comes from the outburst) or it would be appended
+	// to the output of the last run
+	if ((this->dirty & STAGE_COOLING) && (this->time_to_run <= 0.0 || (this->output_heating && this->output_cooling)))
+		invalidate(STAGE_HEATING);
+
+	// Heating phase
+	if (this->dirty & STAGE_HEATING) {
+		this->crust.reset();
+		if (this->use_piecewise) {
+			// initial temperature profile was specified in the init.dat file
+			if (this->nvec == 1) {
+				fail("ERROR:The piecewise flag is set but the temperature profile is not specified in init.dat!");
+			}
+			// set_temperature_profile modifies the arrays (and adds the base point), so pass a copy
+			double rho[104], T[104];
+			for (int i=0; i<104; i++) {
+				rho[i] = (i < this->nvec) ? this->rhovec[i] : 0.0;
+				T[i] = (i < this->nvec) ? this->Tvec[i] : this->crust.Tc;
+			}
+			this->crust.set_temperature_profile(rho,T,this->nvec);
+		} else {
+			// evolve the crust while heating
+			this->crust.output=this->output_heating;   // default is to not output the lightcurve while heating
+			// now evolve for the set outburst_duration and mdot
+			// if these were not specified in the init.dat file,
+			// then they have default values of 1 hour and mdot=1.0 which is used for the
+			// magnetar case (rapid heating)
+			// the outburst may already have been run with these parameters
+			// (the cache isn't used if the outburst writes output or the cooling
+			// is skipped, since then chi-squared needs the outburst itself)
+			int cached = this->cache_outburst > 0 && !this->output_heating && !this->crust.resume
+				&& this->time_to_run > 0.0;
+			unsigned long long key = cached ? heating_key() : 0;
+			if (cached && heating_cache().get(key,this->heated_T,this->cache_outburst,this->cache_disk)
+					&& (int) this->heated_T.size() == this->crust.N+2) {
+				printf("Using the cached profile at the end of the outburst\n");
+				for (int i=0; i<=this->crust.N+1; i++) this->crust.grid[i].T=this->heated_T[i];
+			} else {
+				this->crust.evolve(outburst_duration*365.0,mdot);
+				if (cached) {
+					this->heated_T.resize(this->crust.N+2);
+					for (int i=0; i<=this->crust.N+1; i++) this->heated_T[i]=this->crust.grid[i].T;
+					heating_cache().put(key,this->heated_T,this->cache_outburst,this->cache_disk);
+				}
+			}
+		}
+		// keep the end of the outburst so that the cooling can be rerun from here
+		this->heated_T.resize(this->crust.N+2);
+		for (int i=0; i<=this->crust.N+1; i++) this->heated_T[i]=this->crust.grid[i].T;
+		this->heated_time=this->crust.timesofar;
+		this->heated_last_output=this->crust.last_time_output;
+	} else if (this->dirty & STAGE_COOLING) {
+		for (int i=0; i<=this->crust.N+1; i++) this->crust.grid[i].T=this->heated_T[i];
+		this->crust.timesofar=this->heated_time;
+		this->crust.last_time_output=this->heated_last_output;
+	}
+
+	// Cooling phase
+	if ((this->dirty & STAGE_COOLING) && this->time_to_run > 0.0) {
+		this->crust.output=this->output_cooling;
+		this->crust.evolve(this->time_to_run,0.0);
+	}
+
+	// Calculate the chi-sq
+	if (this->dirty & STAGE_CHISQ) this->chisq = this->data.calculate_chisq(this->crust);
+
+	this->crust.mdot=mdot;
+	this->crust.outburst_duration=outburst_duration;
+	mark_done();
+	return this->chisq;
+}
+
+
+void latin_hypercube(int n, std::vector<Prior> &priors, unsigned long seed, double *u, double *x)
+// each parameter takes one value from each of n equal slices of its prior, in a random order
+{
+	int ndim=(int) priors.size();
+	gsl_rng *rng=gsl_rng_alloc(gsl_rng_mt19937);
+	gsl_rng_set(rng,seed);
+	std::vector<int> slice(n);
+	for (int d=0; d<ndim; d++) {
+		Prior &p=priors[d];
+		for (int k=0; k<n; k++) slice[k]=k;
+		gsl_ran_shuffle(rng,slice.data(),n,sizeof(int));
+		for (int k=0; k<n; k++) {
+			u[k*ndim+d]=(slice[k]+gsl_rng_uniform(rng))/n;
+			x[k*ndim+d]=p.min+u[k*ndim+d]*(p.max-p.min);
+		}
+	}
+	gsl_rng_free(rng);
+}
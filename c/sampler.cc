@@ -0,0 +1,537 @@
+// class Sampler
+//
+// Ensemble MCMC sampler (see h/sampler.h). Each step moves the two halves of the
+// walkers in turn: walker k proposes y = x_j + z (x_k - x_j), where x_j is a
+// random walker from the other half and z is drawn from g(z) ~ 1/sqrt(z) on
+// [1/a, a], and y is accepted with probability min(1, z^(ndim-1) p(y)/p(x_k)).
+// The proposals for one half are run in parallel on the pool.
+//
+// With parallel tempering there are ntemps such ensembles, at temperatures
+// spaced geometrically from 1 to tmax, each sampling p^beta with beta=1/T (the
+// stretch moves only use walkers at the same temperature). The proposals for
+// every temperature are run together, and after each step every walker at
+// temperature t proposes to swap with a random partner at t-1 (going down from
+// the hottest), which is accepted with probability
+// min(1, exp((beta_{t-1}-beta_t)(lnp_t-lnp_{t-1}))). Only the beta=1 walkers
+// sample the posterior; the hot ones let them cross between separated modes.
+//
+// With "cheap" lines in init.dat the moves use delayed acceptance (Christen &
+// Fox 2005, J. Comput. Graph. Stat. 14, 795): a proposal is first screened with
+// a cheap model (e.g. a coarser grid, looser integrator tolerance and coarser
+// tables), accepting with min(1, z^(ndim-1) exp(beta (lnc(y)-lnc(x)))), and
+// only those that pass are run with the full model and accepted with
+// min(1, exp(beta ((lnp(y)-lnp(x)) - (lnc(y)-lnc(x))))). The product of the two
+// is a valid acceptance probability for the full posterior, so the chain is
+// exact; the cheap model only changes how many proposals reach the full model.
+//
+// All the random numbers are drawn serially, from a generator seeded from the
+// seed and the step number, so that a chain is the same for any number of
+// threads and a resumed chain is the same as one that was never stopped.
+//
+// The chain file starts with a header
+//     char tag[8] ("crustmc"), int ndim, int nwalkers, int ntemps, int (unused),
+//     unsigned long long seed, double tmax, char name[64] for each parameter
+// followed by one record per step of ntemps*nwalkers*(ndim+1) doubles: for each
+// temperature (coldest first) and walker its ndim coordinates and then its
+// (untempered) log posterior.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <gsl/gsl_randist.h>
+#include "../h/sampler.h"
+#include "../h/timer.h"
+
+static const char chain_tag[8]="crustmc";
+
+struct ChainHeader {
+	char tag[8];
+	int ndim, nwalkers, ntemps, unused;
+	unsigned long long seed;
+	double tmax;
+};
+
+
+Sampler::Sampler(Run &base, int nthreads) : base(base), priors(base.priors), pool(nthreads)
+{
+	this->ndim=(int) this->priors.size();
+	if (this->ndim == 0) {
+		printf("No priors are given in the init file, so there is nothing to sample\n");
+		exit(1);
+	}
+	this->nwalkers=2*this->ndim;
+	this->ntemps=1;
+	this->tmax=100.0;
+	this->a=2.0;
+	this->seed=1;
+	this->step=0;
+	this->naccepted=0;
+	this->nswapped=0;
+	this->npassed=0;
+	for (int d=0; d<this->ndim; d++) {
+		if (base.data.profile_L && (!strcmp(this->priors[d].name,"Lscale") || !strcmp(this->priors[d].name,"Lmin"))) {
+			printf("%s has a prior, but it is fitted in chisq because profile_L is set\n", this->priors[d].name);
+			exit(1);
+		}
+	}
+	this->emulator=NULL;
+	this->emu_tol=base.emu_tol;
+	this->nemulated=0;
+	this->nmodels=0;
+	if (base.emulator[0] != '\0') {
+		this->emulator = new Emulator;
+		if (!this->emulator->load(base.emulator)) exit(1);
+		int match = (this->emulator->ndim == this->ndim && this->emulator->nout == base.data.n);
+		for (int d=0; match && d<this->ndim; d++) {
+			Prior &p=this->priors[d], &q=this->emulator->priors[d];
+			if (strcmp(p.name,q.name) || p.min != q.min || p.max != q.max || p.log != q.log) match=0;
+		}
+		if (!match) {
+			printf("The emulator in %s was trained with different priors or data\n", base.emulator);
+			exit(1);
+		}
+		// the emulator gives the residuals, and the marginalization penalty needs the model
+		if (base.data.profile_L == 2) {
+			printf("The emulator can't be used with profile_L=2\n");
+			exit(1);
+		}
+	}
+	this->workers.assign(nthreads,(Run *) NULL);
+	this->cheap_workers.assign(nthreads,(Run *) NULL);
+	this->rng=gsl_rng_alloc(gsl_rng_mt19937);
+
+	// the workers share the base model's grid and tables
+	// (no output files, since the models run at the same time)
+	base.output_heating=0;
+	base.output_cooling=0;
+	base.crust.output=0;
+	if (base.needs_setup) base.setup();
+
+	// and the cheap model's workers share its grid and tables
+	this->cheap_base=NULL;
+	if (!base.cheap.empty()) {
+		this->cheap_base = new Run;
+		this->cheap_base->copy_parameters(base);
+		for (int k=0; k<(int) base.cheap.size(); k++)
+			this->cheap_base->set_parameter(base.cheap[k].name,base.cheap[k].value);
+		this->cheap_base->output_heating=0;
+		this->cheap_base->output_cooling=0;
+		this->cheap_base->crust.output=0;
+		this->cheap_base->setup();
+	}
+}
+
+
+Sampler::~Sampler()
+{
+	for (int w=0; w<(int) this->workers.size(); w++) {
+		delete this->workers[w];
+		delete this->cheap_workers[w];
+	}
+	delete this->cheap_base;
+	delete this->emulator;
+	gsl_rng_free(this->rng);
+}
+
+
+double Sampler::value(int d, double xd)
+// the parameter value at coordinate xd
+{
+	return this->priors[d].log ? pow(10.0,xd) : xd;
+}
+
+double Sampler::coordinate(int d, double value)
+{
+	return this->priors[d].log ? log10(value) : value;
+}
+
+
+double Sampler::lnprior(const double *x)
+// 0 inside the priors and -infinity outside
+{
+	for (int d=0; d<this->ndim; d++)
+		if (!(x[d] >= this->priors[d].min && x[d] <= this->priors[d].max)) return -INFINITY;
+	return 0.0;
+}
+
+
+double Sampler::lnprob(Run *run, Run &from, const double *x)
+// log posterior at x, using the parameters of the run from (the base or the cheap model)
+{
+	if (lnprior(x) == -INFINITY) return -INFINITY;
+	run->copy_parameters(from);
+	for (int d=0; d<this->ndim; d++) run->set_parameter(this->priors[d].name,value(d,x[d]));
+	run->output_heating=0;
+	run->output_cooling=0;
+	run->crust.output=0;
+	if (run->needs_setup) {
+		if (run->same_setup(from)) run->setup_from(from);
+		else run->setup();
+	}
+	double chisq=run->run();
+	if (!isfinite(chisq)) return -INFINITY;
+	return -0.5*chisq;
+}
+
+
+void Sampler::evaluate(int n, const double *x, double *lnp, int cheap, double *resid)
+// log posterior of the n points x[i*ndim+d], in parallel, with the full model
+// or (if cheap is set) the cheap one; if resid is given, the residuals of the
+// ndata data points for point i go in resid[i*ndata+j] (NAN if it wasn't run).
+// Without resid, the emulator (if there is one) stands in for the full model
+// wherever its uncertainty in chisq is below emu_tol.
+{
+	std::vector<Run *> &workers = cheap ? this->cheap_workers : this->workers;
+	Run &from = cheap ? *this->cheap_base : this->base;
+	int ndata=from.data.n;
+	std::vector<char> emulated(n,0);
+	if (this->emulator != NULL && !cheap && resid == NULL) {
+		std::vector<double> u(this->ndim);
+		for (int i=0; i<n; i++) {
+			const double *xi=&x[i*this->ndim];
+			if (lnprior(xi) == -INFINITY) continue;
+			for (int d=0; d<this->ndim; d++) u[d]=(xi[d]-this->priors[d].min)/(this->priors[d].max-this->priors[d].min);
+			double sd, chisq=this->emulator->chisq(this->base.data,u.data(),&sd);
+			if (sd < this->emu_tol) {
+				lnp[i]=-0.5*chisq;
+				emulated[i]=1;
+				this->nemulated++;
+			}
+		}
+	}
+	for (int i=0; i<n; i++) {
+		if (emulated[i]) continue;
+		if (!cheap) this->nmodels++;
+		this->pool.submit([=,&workers,&from](int w) {
+			// each worker's Run is set up on its first model
+			if (workers[w] == NULL) workers[w] = new Run;
+			lnp[i]=lnprob(workers[w],from,&x[i*this->ndim]);
+			if (resid != NULL) {
+				double *r=workers[w]->data.residual;
+				for (int j=0; j<ndata; j++) resid[i*ndata+j] = (lnp[i] > -INFINITY) ? r[j+1] : NAN;
+			}
+		});
+	}
+	this->pool.wait();
+}
+
+
+void Sampler::seed_step(int k)
+{
+	gsl_rng_set(this->rng,this->seed+1000003UL*(unsigned long) k);
+}
+
+
+void Sampler::start(void)
+// puts the walkers in a small ball around the parameters in init.dat
+// (or around the middle of the prior if they are outside it)
+{
+	int ndim=this->ndim;
+	this->nwalkers += this->nwalkers%2;
+	if (this->nwalkers < 2*ndim) this->nwalkers=2*ndim;
+	if (this->ntemps < 1) this->ntemps=1;
+	set_ladder();
+	int n=this->ntemps*this->nwalkers;
+	this->x.resize(n*ndim);
+	this->lnp.resize(n);
+	this->step=0;
+	seed_step(0);
+
+	std::vector<double> x0(ndim), width(ndim);
+	auto draw = [&](int k, int d) {
+		Prior &p=this->priors[d];
+		double xd;
+		do xd = x0[d]+gsl_ran_gaussian(this->rng,width[d]); while (xd < p.min || xd > p.max);
+		this->x[k*ndim+d]=xd;
+	};
+	for (int d=0; d<ndim; d++) {
+		Prior &p=this->priors[d];
+		x0[d]=coordinate(d,this->base.get_parameter(p.name));
+		if (!(x0[d] >= p.min && x0[d] <= p.max)) x0[d]=0.5*(p.min+p.max);
+		width[d]=0.01*(p.max-p.min);
+		for (int k=0; k<n; k++) draw(k,d);
+	}
+	evaluate(n,this->x.data(),this->lnp.data());
+	if (this->cheap_base == NULL) return;
+	this->lnc.resize(n);
+	evaluate(n,this->x.data(),this->lnc.data(),1);
+
+	// with delayed acceptance a walker where the cheap model fails (lnc=-inf) can
+	// never move, since every proposal that gets past the screening has lnq=-inf,
+	// so such walkers are drawn again
+	for (int tries=0; ; tries++) {
+		std::vector<int> bad;
+		for (int k=0; k<n; k++) if (this->lnc[k] == -INFINITY) bad.push_back(k);
+		if (bad.empty()) break;
+		if (tries == 100) {
+			printf("The cheap model fails at %d of the starting points\n", (int) bad.size());
+			exit(1);
+		}
+		int nbad=bad.size();
+		std::vector<double> xbad(nbad*ndim), lnpbad(nbad), lncbad(nbad);
+		for (int b=0; b<nbad; b++) {
+			for (int d=0; d<ndim; d++) {
+				draw(bad[b],d);
+				xbad[b*ndim+d]=this->x[bad[b]*ndim+d];
+			}
+		}
+		evaluate(nbad,xbad.data(),lnpbad.data());
+		evaluate(nbad,xbad.data(),lncbad.data(),1);
+		for (int b=0; b<nbad; b++) {
+			this->lnp[bad[b]]=lnpbad[b];
+			this->lnc[bad[b]]=lncbad[b];
+		}
+	}
+}
+
+
+void Sampler::set_ladder(void)
+// temperatures spaced geometrically between 1 and tmax
+{
+	this->beta.resize(this->ntemps);
+	for (int t=0; t<this->ntemps; t++)
+		this->beta[t] = (this->ntemps == 1) ? 1.0 : pow(this->tmax,-(double) t/(this->ntemps-1));
+}
+
+
+static double diff(double a, double b)
+// a-b, taking the difference of two equal infinities to be zero
+{
+	return (a == b) ? 0.0 : a-b;
+}
+
+
+void Sampler::advance(void)
+// moves every walker once, and then proposes swaps between the temperatures
+{
+	int ndim=this->ndim, half=this->nwalkers/2, ntemps=this->ntemps, nw=this->nwalkers, M=ntemps*half;
+	int delayed = (this->cheap_base != NULL);
+	std::vector<double> y(M*ndim), lny(M), lncy(M), z(M), u(M), u1(M);
+	std::vector<double> ypass(M*ndim), lnypass(M);
+	std::vector<int> pass(M);
+	this->step++;
+	seed_step(this->step);
+	this->naccepted=0;
+	this->npassed=0;
+	for (int h=0; h<2; h++) {
+		int first=h*half, other=(1-h)*half;
+		for (int t=0; t<ntemps; t++) {
+			for (int i=0; i<half; i++) {
+				int m=t*half+i, k=t*nw+first+i, j=t*nw+other+(int) gsl_rng_uniform_int(this->rng,half);
+				z[m]=pow((this->a-1.0)*gsl_rng_uniform(this->rng)+1.0,2.0)/this->a;
+				u[m]=gsl_rng_uniform_pos(this->rng);
+				if (delayed) u1[m]=gsl_rng_uniform_pos(this->rng);
+				for (int d=0; d<ndim; d++)
+					y[m*ndim+d]=this->x[j*ndim+d]+z[m]*(this->x[k*ndim+d]-this->x[j*ndim+d]);
+			}
+		}
+
+		// screen the proposals with the cheap model, and run the rest with the full one
+		int npass=0;
+		if (delayed) evaluate(M,y.data(),lncy.data(),1);
+		for (int m=0; m<M; m++) {
+			int t=m/half, k=t*nw+first+m%half;
+			if (delayed && log(u1[m]) >= (ndim-1)*log(z[m])+this->beta[t]*diff(lncy[m],this->lnc[k])) continue;
+			for (int d=0; d<ndim; d++) ypass[npass*ndim+d]=y[m*ndim+d];
+			pass[npass++]=m;
+		}
+		evaluate(npass,ypass.data(),lnypass.data());
+		for (int p=0; p<npass; p++) lny[pass[p]]=lnypass[p];
+
+		for (int p=0; p<npass; p++) {
+			int m=pass[p], t=m/half, k=t*nw+first+m%half;
+			double lnq;
+			if (delayed) lnq=this->beta[t]*(diff(lny[m],this->lnp[k])-diff(lncy[m],this->lnc[k]));
+			else lnq=(ndim-1)*log(z[m])+this->beta[t]*diff(lny[m],this->lnp[k]);
+			if (t == 0) this->npassed++;
+			if (log(u[m]) < lnq) {
+				for (int d=0; d<ndim; d++) this->x[k*ndim+d]=y[m*ndim+d];
+				this->lnp[k]=lny[m];
+				if (delayed) this->lnc[k]=lncy[m];
+				if (t == 0) this->naccepted++;
+			}
+		}
+	}
+	if (ntemps > 1) swap();
+}
+
+
+void Sampler::swap(void)
+// every walker at temperature t proposes to exchange places with a random
+// walker at t-1, from the hottest pair of temperatures down
+{
+	int ndim=this->ndim, nw=this->nwalkers;
+	std::vector<int> partner(nw);
+	std::vector<double> tmp(ndim);
+	this->nswapped=0;
+	for (int t=this->ntemps-1; t>0; t--) {
+		for (int k=0; k<nw; k++) partner[k]=k;
+		gsl_ran_shuffle(this->rng,partner.data(),nw,sizeof(int));
+		for (int k=0; k<nw; k++) {
+			int hot=t*nw+k, cold=(t-1)*nw+partner[k];
+			double u=gsl_rng_uniform_pos(this->rng);
+			double dlnp=this->lnp[hot]-this->lnp[cold];
+			if (isnan(dlnp) || log(u) >= (this->beta[t-1]-this->beta[t])*dlnp) continue;
+			for (int d=0; d<ndim; d++) {
+				tmp[d]=this->x[hot*ndim+d];
+				this->x[hot*ndim+d]=this->x[cold*ndim+d];
+				this->x[cold*ndim+d]=tmp[d];
+			}
+			double l=this->lnp[hot];
+			this->lnp[hot]=this->lnp[cold];
+			this->lnp[cold]=l;
+			if (this->cheap_base != NULL) {
+				l=this->lnc[hot];
+				this->lnc[hot]=this->lnc[cold];
+				this->lnc[cold]=l;
+			}
+			this->nswapped++;
+		}
+	}
+}
+
+
+int Sampler::resume(const char *fname)
+// reads the last step from an existing chain file; returns 0 if there is no
+// step to carry on from. Exits if the file is for a different set of parameters.
+{
+	FILE *fp = fopen(fname,"rb");
+	if (fp == NULL) return 0;
+	ChainHeader head;
+	int ok = (fread(&head,sizeof(head),1,fp) == 1 && !strcmp(head.tag,chain_tag) && head.ndim == this->ndim);
+	for (int d=0; ok && d<this->ndim; d++) {
+		char name[64];
+		ok = (fread(name,64,1,fp) == 1 && !strcmp(name,this->priors[d].name));
+	}
+	if (!ok) {
+		printf("The chain file %s is not for these parameters\n", fname);
+		exit(1);
+	}
+	long start=ftell(fp);
+	fseek(fp,0,SEEK_END);
+	int n=head.ntemps*head.nwalkers;
+	long recsize=(long) n*(this->ndim+1)*sizeof(double);
+	int nsteps=(int) ((ftell(fp)-start)/recsize);
+	this->nwalkers=head.nwalkers;
+	this->ntemps=head.ntemps;
+	this->tmax=head.tmax;
+	this->seed=(unsigned long) head.seed;
+	set_ladder();
+	if (nsteps == 0) {
+		fclose(fp);
+		return 0;
+	}
+
+	std::vector<double> rec(n*(this->ndim+1));
+	fseek(fp,start+(nsteps-1)*recsize,SEEK_SET);
+	ok = (fread(rec.data(),recsize,1,fp) == 1);
+	fclose(fp);
+	if (!ok) return 0;
+	this->x.resize(n*this->ndim);
+	this->lnp.resize(n);
+	for (int k=0; k<n; k++) {
+		for (int d=0; d<this->ndim; d++) this->x[k*this->ndim+d]=rec[k*(this->ndim+1)+d];
+		this->lnp[k]=rec[k*(this->ndim+1)+this->ndim];
+	}
+	this->step=nsteps;
+
+	// the cheap model isn't saved, but it gives the same values again
+	if (this->cheap_base != NULL) {
+		this->lnc.resize(n);
+		evaluate(n,this->x.data(),this->lnc.data(),1);
+		for (int k=0; k<n; k++) {
+			if (this->lnc[k] == -INFINITY) {
+				printf("The cheap model fails at walker %d of the chain in %s (has it changed?)\n", k, fname);
+				exit(1);
+			}
+		}
+	}
+
+	// drop a step that was only partly written
+	if (truncate(fname,start+nsteps*recsize) != 0) {
+		printf("Could not truncate %s\n", fname);
+		exit(1);
+	}
+	return 1;
+}
+
+
+void Sampler::checkpoint(const char *fname)
+// appends the current step to the chain file (with the header if it is the first)
+{
+	FILE *fp = fopen(fname,this->step <= 1 ? "wb" : "ab");
+	if (fp == NULL) {
+		printf("Could not write the chain to %s\n", fname);
+		exit(1);
+	}
+	if (this->step <= 1) {
+		ChainHeader head;
+		memset(&head,0,sizeof(head));
+		strcpy(head.tag,chain_tag);
+		head.ndim=this->ndim;
+		head.nwalkers=this->nwalkers;
+		head.ntemps=this->ntemps;
+		head.seed=this->seed;
+		head.tmax=this->tmax;
+		fwrite(&head,sizeof(head),1,fp);
+		for (int d=0; d<this->ndim; d++) {
+			char name[64];
+			memset(name,0,64);
+			strncpy(name,this->priors[d].name,63);
+			fwrite(name,64,1,fp);
+		}
+	}
+	for (int k=0; k<this->ntemps*this->nwalkers; k++) {
+		fwrite(&this->x[k*this->ndim],sizeof(double),this->ndim,fp);
+		fwrite(&this->lnp[k],sizeof(double),1,fp);
+	}
+	fclose(fp);
+}
+
+
+void run_sampler(Run &base, const char *chain, int nthreads, SamplerOptions &opt)
+{
+	// progress goes to stdout, so move everything else to stderr
+	fflush(stdout);
+	FILE *out = fdopen(dup(1),"w");
+	dup2(2,1);
+
+	Sampler sampler(base,nthreads);
+	if (opt.nwalkers > 0) sampler.nwalkers=opt.nwalkers;
+	if (opt.ntemps > 0) sampler.ntemps=opt.ntemps;
+	if (opt.tmax > 1.0) sampler.tmax=opt.tmax;
+	sampler.seed=opt.seed;
+	if (sampler.resume(chain)) {
+		fprintf(out,"Resuming %s at step %d with %d walkers at %d temperatures\n", chain, sampler.step,
+			sampler.nwalkers, sampler.ntemps);
+	} else {
+		fprintf(out,"Starting %d walkers at %d temperatures in %d dimensions\n", sampler.nwalkers,
+			sampler.ntemps, sampler.ndim);
+		sampler.start();
+	}
+	fflush(out);
+
+	double start=wall_time();
+	int first=sampler.step;
+	while (sampler.step < opt.nsteps) {
+		sampler.advance();
+		sampler.checkpoint(chain);
+		double best=-INFINITY;
+		for (int k=0; k<sampler.nwalkers; k++) if (sampler.lnp[k] > best) best=sampler.lnp[k];
+		fprintf(out,"step %d acceptance %.3f chisq_min %.6g time %lg", sampler.step,
+			(double) sampler.naccepted/sampler.nwalkers, -2.0*best, wall_time()-start);
+		if (sampler.ntemps > 1)
+			fprintf(out," swaps %.3f",(double) sampler.nswapped/(sampler.nwalkers*(sampler.ntemps-1)));
+		if (!base.cheap.empty()) fprintf(out," screened %.3f",(double) sampler.npassed/sampler.nwalkers);
+		if (sampler.emulator != NULL)
+			fprintf(out," emulated %.3f",(double) sampler.nemulated/(sampler.nemulated+sampler.nmodels));
+		fprintf(out,"\n");
+		fflush(out);
+	}
+	if (sampler.step > first)
+		fprintf(out,"Finished %d steps in %lg s\n", sampler.step-first, wall_time()-start);
+	fclose(out);
+}
@@ -0,0 +1,183 @@
+// serve.cc
+//
+// Server mode, 'crustcool --serve <socket>'. The model is set up once and then
+// kept in memory, and parameter sets are read from a Unix domain socket (or
+// from stdin if the socket name is '-', with the results on stdout and the
+// usual output moved to stderr). Each client can send any number of requests.
+//
+// A request is a set of parameter lines as in init.dat, followed by 'run':
+//
+//     Tc	3.1e7
+//     Qimp	2.0
+//     run
+//
+// 'read <file>' reads parameters from a file, 'quit' closes the connection
+// and 'shutdown' stops the server.
+// Parameters keep their values from one request to the next. The reply is
+//
+//     chisq 12.345
+//     setup 0                 1 if the setup had to be redone for this request
+//     time_setup 0
+//     time_evolve 1.234       wall-clock seconds
+//     lightcurve 215          number of points, then one "t y" line each
+//     ...
+//     end
+//
+// or 'error <message>' followed by 'end' if a parameter was not recognized or
+// the model failed (e.g. an envelope that can't be calculated). A request that
+// fails is undone as a whole: the parameters go back to their values before it,
+// and after a failure in the model the setup is redone on the next request.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "../h/serve.h"
+#include "../h/timer.h"
+#include "../h/fail.h"
+
+static int serve_connection(Run &run, FILE *in, FILE *out);
+
+
+void serve(Run &run, const char *path)
+{
+	// a client that goes away while we are replying should not stop the server
+	signal(SIGPIPE,SIG_IGN);
+
+	if (!strcmp(path,"-")) {
+		// replies go to stdout, so move everything else to stderr
+		fflush(stdout);
+		FILE *out = fdopen(dup(1),"w");
+		dup2(2,1);
+		// set up now so that the first request is as fast as the rest
+		run.setup();
+		serve_connection(run,stdin,out);
+		fclose(out);
+		return;
+	}
+
+	int sock = socket(AF_UNIX,SOCK_STREAM,0);
+	struct sockaddr_un addr;
+	memset(&addr,0,sizeof(addr));
+	addr.sun_family=AF_UNIX;
+	if (sock < 0 || strlen(path) >= sizeof(addr.sun_path)) {
+		printf("Could not create socket %s\n", path);
+		exit(1);
+	}
+	strcpy(addr.sun_path,path);
+	unlink(path);
+	if (bind(sock,(struct sockaddr *) &addr,sizeof(addr)) < 0 || listen(sock,8) < 0) {
+		printf("Could not listen on socket %s\n", path);
+		exit(1);
+	}
+	run.setup();
+	printf("Listening on %s\n", path);
+	fflush(stdout);
+
+	// clients are served one at a time; run several servers for a pool of workers
+	while (1) {
+		int fd = accept(sock,NULL,NULL);
+		if (fd < 0) continue;
+		FILE *in = fdopen(fd,"r");
+		FILE *out = fdopen(dup(fd),"w");
+		int quit = serve_connection(run,in,out);
+		fclose(in);
+		fclose(out);
+		if (quit) break;
+	}
+	close(sock);
+	unlink(path);
+}
+
+
+static int serve_connection(Run &run, FILE *in, FILE *out)
+// handles requests until the client disconnects or sends 'quit'.
+// Returns 1 if the server should stop ('shutdown')
+{
+	char line[400], key[200], value[200];
+	char error[400]="";
+	// the parameters before the current request, to undo it if it fails
+	Run *saved = new Run;
+	int in_request=0;
+	int quit=0;
+
+	while (fgets(line,400,in) != NULL) {
+		if (sscanf(line,"%199s",key) != 1 || key[0] == '#') continue;
+
+		if (!strcmp(key,"quit")) break;
+		if (!strcmp(key,"shutdown")) {
+			quit=1;
+			break;
+		}
+
+		if (!in_request) {
+			saved->copy_parameters(run);
+			in_request=1;
+		}
+
+		if (!strcmp(key,"read")) {
+			if (sscanf(line,"%199s %199s",key,value) != 2 || !run.read_parameters(value))
+				sprintf(error,"could not read parameter file");
+			continue;
+		}
+
+		if (strcmp(key,"run")) {
+			// a parameter
+			int found;
+			if (sscanf(line,"%199s %199s",key,value) != 2) found=0;
+			else if (!strncmp(key,"source",6) || !strncmp(key,"envlib",6))
+				found = run.set_string_parameter(key,value);
+			else
+				found = run.set_parameter(key,atof(value));
+			if (!found) sprintf(error,"unknown parameter %s",key);
+			continue;
+		}
+
+		// run the model
+		in_request=0;
+		if (error[0] != '\0') {
+			run.copy_parameters(*saved);
+			fprintf(out,"error %s\nend\n",error);
+			fflush(out);
+			error[0]='\0';
+			continue;
+		}
+		int did_setup = run.needs_setup;
+		double t0 = wall_time(), t1=t0, t2=t0, chisq=0.0;
+		fail_by_throwing(1);
+		try {
+			if (did_setup) run.setup();
+			t1 = wall_time();
+			chisq = run.run();
+			t2 = wall_time();
+		} catch (Failure &e) {
+			fail_by_throwing(0);
+			fflush(stdout);
+			run.copy_parameters(*saved);
+			run.invalidate(STAGE_SETUP);
+			fprintf(out,"error %s\nend\n",e.message);
+			fflush(out);
+			continue;
+		}
+		fail_by_throwing(0);
+		fflush(stdout);
+
+		fprintf(out,"chisq %.10g\n",chisq);
+		fprintf(out,"setup %d\n",did_setup);
+		fprintf(out,"time_setup %lg\n",t1-t0);
+		fprintf(out,"time_evolve %lg\n",t2-t1);
+		fprintf(out,"lightcurve %d\n",run.data.nmodel);
+		for (int k=1; k<=run.data.nmodel; k++)
+			fprintf(out,"%.10g %.10g\n",run.data.tmodel[k],run.data.ymodel[k]);
+		fprintf(out,"end\n");
+		fflush(out);
+	}
+	// an unfinished request that already failed is undone too
+	if (in_request && error[0] != '\0') run.copy_parameters(*saved);
+	delete saved;
+	return quit;
+}
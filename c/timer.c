@@ -10,3 +10,11 @@ void stop_timing(clock_t *time, const char*string)
 {
   	printf(">Time taken for %s =%lg s\n", string, (double) (clock()-*time)/((double) CLOCKS_PER_SEC)); 	
 }
+
+double wall_time(void)
+// wall-clock time in seconds (clock() adds up the time on all threads)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
@@ -2,6 +2,7 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
 
 double *vector(long n)
 {
@@ -27,5 +28,35 @@ void free_matrix(double **m, long nr, long nc)
 	delete [] m;
 }
 
+int cholesky(int n, double *a)
+// replaces the lower triangle of the symmetric matrix a[i*n+j] with its Cholesky
+// factor; returns 0 if a is not positive definite
+{
+	for (int j=0; j<n; j++) {
+		double s=a[j*n+j];
+		for (int k=0; k<j; k++) s-=a[j*n+k]*a[j*n+k];
+		if (!(s > 0.0)) return 0;
+		a[j*n+j]=sqrt(s);
+		for (int i=j+1; i<n; i++) {
+			double t=a[i*n+j];
+			for (int k=0; k<j; k++) t-=a[i*n+k]*a[j*n+k];
+			a[i*n+j]=t/a[j*n+j];
+		}
+	}
+	return 1;
+}
 
-
+void cholesky_solve(int n, const double *L, const double *b, double *x)
+// solves L L^T x = b
+{
+	for (int i=0; i<n; i++) {
+		double s=b[i];
+		for (int k=0; k<i; k++) s-=L[i*n+k]*x[k];
+		x[i]=s/L[i*n+i];
+	}
+	for (int i=n-1; i>=0; i--) {
+		double s=x[i];
+		for (int k=i+1; k<n; k++) s-=L[k*n+i]*x[k];
+		x[i]=s/L[i*n+i];
+	}
+}
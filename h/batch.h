@@ -0,0 +1,8 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "run.h"
+
+void run_batch(Run &base, const char *manifest, int nthreads);
+
+#endif
@@ -1,26 +1,40 @@
 #include "../h/odeint.h"
 #include "../h/spline.h"
 #include "../h/eos.h"
-
-struct GridPoint {
-	double rho, CP, P, K, F, T, NU, EPS, Qheat, Qimpur, r;
-};
+#include "../h/crustmodel.h"
+#include <vector>
 
 
+// A Crust holds the state of one run (temperatures, heating, integrator) and
+// the parameters, and uses a CrustModel for the grid and tables, which is either
+// made by setup or shared with another crust (use_model). Each crust has its own
+// EOS and integrator, so several can be evolved at the same time on different
+// threads (set output=0 for them, since the files in out/ are shared).
 class Crust: public Ode_Int_Delegate {
 public:
 	Crust();
     ~Crust();
 	void setup(void);
+	void reset(void);
 	void evolve(double time, double mdot);
+	void make_tables(void);
+	void use_model(CrustModel *model);
 	void set_temperature_profile(double *rhovec,double *Tvec,int nvec);
 	
+	CrustModel *model;
+
 	int N;
 	double Pb, Pt, yt, dx;
 
 	GridPoint *grid;
+	// while pins > 0 (the grid is exported, see libcrustcool.h) a grid that is
+	// replaced is kept until unpin rather than freed
+	int pins;
+	void unpin(void);
 
 	int output, use_my_envelope, gpe, resume;
+	double ylight;    // log10 column of the light element layer (library envelopes)
+	char envelope_library[200];
 	
 	double mass,radius,g,ZZ;
 	double C_core, Lnu_core_norm, Lnu_core_alpha;
@@ -30,6 +44,9 @@ public:
 	int gap,accr,use_potek_eos;		
 			
 	int force_precalc,extra_heating,nuflag,force_cooling_bc;
+	int shared_tables;   // share the tables with other processes (see attach_tables)
+	int table_nbeta;     // number of temperatures in the tables (default 100)
+	double ode_eps;      // accuracy of the time integration (default 1e-7)
 	double rhot,rhob,heating_P1,heating_P2;
 	double energy_deposited_outer,energy_deposited_inner,energy_slope;
 	double mdot,outburst_duration;
@@ -38,26 +55,48 @@ public:
 	double angle_mu,Tt,Tc,Qrho,Qinner;
 	
 	Spline TEFF;
+	double envelope_g;  // gravity for which TEFF was calculated
 	
 	Ode_Int ODE;
 	
+	double surface_flux(double T, double *dFdT);
+
 	void derivs(double t, double T[], double dTdt[]);
 	void jacobn(double, double *, double *, double **, int);
 					
 private:
+	friend class Ensemble;   // works directly on the tables and grid
+	friend class ReducedModel;   // and evaluates dTdt at a few cells
+
 	int hardwireQ, heating;
+	double Qinner_eff, Einner_eff;   // Qinner and Einner with the defaults filled in
 
-	int nbeta;
+	int nbeta, ntable, tables_ready;    // the tables point into the model's, except EPS_grid
 	double **CP_grid, **K1_grid, **K0_grid, **NU_grid, **EPS_grid, **KAPPA_grid, **K1perp_grid, **K0perp_grid;
 	double betamin, betamax, deltabeta;
 	FILE *fp,*fp2;
 	
+	std::vector<GridPoint *> retired_grids;
+	void new_grid(void);
 	void set_up_grid(const char *fname);
 	void get_TbTeff_relation(void);
+	int read_TbTeff_grid(const char *fname);
+	int get_TbTeff_relation_from_library(void);
+	void solve_TbTeff_relation(void);
+	double envelope_yi(void);
 	void set_composition(void);
 	double crust_heating(int i);
 	double total_heating_rate(void);
 	void precalculate_vars(void);
+	void build_tables(void);
+	void calculate_tables(void);
+	int read_tables(void);
+	void precalc_filename(char *s);
+	void free_tables(void);
+	unsigned long long table_key(void);
+	void shared_table_path(char *s);
+	int attach_tables(void);
+	int publish_tables(void);
 	double eps_from_heat_source(double P,double y1,double y2,double Q_heat);
 
 	void output_result_for_step(int j, FILE *fp, FILE *fp2,double timesofar,double *last_time_output);
@@ -65,7 +104,12 @@ private:
 	
 	double dTdt(int i, double *T);
 	void calculate_vars(int i);
+	int cooling_boundary(void);
 	double calculate_heat_flux(int i, double *T);
+	double surface_flux_exact(double T);
+	void make_surface_flux_table(void);
+	int nflux;
+	double *flux_table, lgTflux_min, dlgTflux;
 	void outer_boundary(void);
 	
 	Spline AASpline; 
@@ -0,0 +1,55 @@
+// The parts of a crust that take time to make and then don't change: the grid,
+// the precalculated tables and the surface flux table. Crust::setup makes a
+// CrustModel, and any number of other crusts can use it (Crust::use_model)
+// instead of being set up themselves, so that each of them only holds the state
+// of one run. Models are reference counted, and a model is deleted when the last
+// crust using it is set up again or deleted.
+
+#ifndef CRUSTMODEL_H
+#define CRUSTMODEL_H
+
+#include <atomic>
+#include <mutex>
+#include <stddef.h>
+
+struct GridPoint {
+	double rho, CP, P, K, F, T, NU, EPS, Qheat, Qimpur, r;
+};
+
+class CrustModel {
+public:
+	CrustModel(int N);
+	void retain(void);
+	void release(void);
+
+	// the grid, and the setup parameters that it was made for
+	int N, hardwireQ;
+	double Pb, Pt, yt, dx, g, ZZ, mass, radius;
+	GridPoint *grid;
+
+	// EOS settings
+	double B, kncrit;
+	int gap, accr, use_potek_eos;
+
+	// surface flux on a grid in log10 T
+	int nflux;
+	double *flux_table, lgTflux_min, dlgTflux;
+
+	// material properties on the grid as a function of log10 T; they are made by
+	// the first crust that needs them, holding lock
+	int tables_ready, nbeta;
+	double betamin, betamax, deltabeta;
+	double **CP_grid, **K1_grid, **K0_grid, **NU_grid, **KAPPA_grid, **K1perp_grid, **K0perp_grid;
+	std::mutex lock;
+
+	// set if the tables are mapped from a shared file (see Crust::attach_tables)
+	void *table_map;
+	size_t table_map_size;
+	double **table_rows;
+
+private:
+	~CrustModel();
+	std::atomic<int> refs;
+};
+
+#endif
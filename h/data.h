@@ -1,14 +1,40 @@
+#include <vector>
+
 class Crust;
 
 class Data {
 public:
+	Data();
+	~Data();
 	double *t, *TT, *Te;
 	int n;
 	int luminosity;
+	int profile_L;    // with luminosities, fit Lscale and Lmin (1), or marginalize over them (2)
+	// with profile_L, the fitted model luminosity Lfit_a*L + Lfit_b from the last
+	// call to calculate_chisq (Lfitted=0 if the fit was degenerate and crust.Lscale
+	// and crust.Lmin were used instead)
+	double Lfit_a, Lfit_b;
+	int Lfitted;
+
+	// the model lightcurve from the last call to calculate_chisq
+	// (observer time in days, and Teff in eV or luminosity in erg/s)
+	double *tmodel, *ymodel;
+	int nmodel;
+	// while pins > 0 (the lightcurve is exported, see libcrustcool.h) buffers that
+	// are outgrown are kept until unpin rather than freed
+	int pins;
+	void unpin(void);
+	// and (data-model)/error for each data point; with profile_L=2 the sum of their
+	// squares is the profiled chisq, without the marginalization penalty
+	double *residual;
 	
 	void read_in_data(const char *fname);
-	void calculate_chisq(Crust &crust);
-};
-
-
+	double calculate_chisq(Crust &crust);
+	double calculate_chisq(Crust &crust, int nmodel, double *time, double *Ttop);
 
+private:
+	int nmodel_max;
+	std::vector<double *> retired;
+	void free_data(void);
+	double profile_luminosity(double *xx, double *yy, int nmodel);
+};
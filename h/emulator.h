@@ -0,0 +1,44 @@
+// Gaussian process emulator of the model at the times of the data points, over
+// the priors of the samplers. It is trained on models at a Latin hypercube of
+// points (run_emulate), and predicts the model and its uncertainty at each data
+// point, and from them chi-squared and its uncertainty. The samplers use it in
+// place of the model where that uncertainty is small (see "emulator" in init.dat).
+
+#ifndef EMULATOR_H
+#define EMULATOR_H
+
+#include <vector>
+#include "run.h"
+
+class Emulator {
+public:
+	Emulator();
+
+	int ndim, nout, ntrain;        // parameters, outputs (data points), and training points
+	std::vector<Prior> priors;     // the priors it was trained over
+	std::vector<double> u;         // training points in the unit cube, u[k*ndim+d]
+	std::vector<double> y;         // the model at the data points, y[k*nout+j]
+	std::vector<double> ell;       // correlation lengths in the unit cube
+	double nugget;                 // relative noise variance
+
+	void add(const double *u, const double *y);
+	void train(void);
+	int load(const char *fname);
+	void save(const char *fname);
+	void predict(const double *u, double *mean, double *sd);
+	double chisq(Data &data, const double *u, double *sd);
+
+private:
+	std::vector<double> L;         // Cholesky factor of the correlation matrix
+	std::vector<double> mu, var;   // mean and variance of each output
+	std::vector<double> alpha;     // K^-1 (y-mu) for each output, alpha[j*ntrain+k]
+	double correlation(const double *a, const double *b, const double *ell);
+	double factor(const double *ell, double nugget);
+};
+
+// 'crustcool --emulate <file> [-j nthreads] [-n ntrain] [-s seed] [name]': runs
+// ntrain models (default 20 per parameter) at a Latin hypercube over the priors,
+// and writes the trained emulator to <file>
+void run_emulate(Run &base, const char *fname, int nthreads, int ntrain, unsigned long seed);
+
+#endif
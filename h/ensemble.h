@@ -0,0 +1,55 @@
+// Evolves many models on the same grid at once, e.g. all the walkers in one
+// MCMC generation. The models share the grid, composition, precalculated tables
+// and envelope of a Run that has been set up, and differ only in Qimp, Qinner,
+// Tc, Tt and mdot. The temperatures are stored as T[cell*nmodels + model] so that
+// every loop over the grid works on all the models at once.
+
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include <vector>
+#include "run.h"
+
+class Ensemble {
+public:
+	Ensemble(Run &base, int nmodels);
+	~Ensemble();
+
+	int nmodels;
+	double *Qimp, *Qinner, *Tc, *Tt, *mdot;   // per model; start with the values in base
+	double *chisq;                             // per model, from the last run
+	double eps;                                // relative accuracy of each step
+
+	void run(void);
+
+	// the cooling curves from the last run: top temperature Tsave[k*nmodels+m]
+	// at time tsave[k] (seconds, star frame)
+	std::vector<double> tsave, Tsave;
+	int nsteps;
+
+private:
+	Run &base;
+	Crust &crust;
+	int N, K;
+	int *heating, *cooling_bc;    // per model, for the current phase
+	double *T, *f0, *f1, *k1, *k2, *Y, *work;
+	double *Kc, *CP, *NU, *F;
+	double *a, *b, *c, *cp, *dinv;
+	double *eps0, *eps_scale, *fac;
+	double *Qin;     // Qinner with the default filled in
+	double gh;       // gamma*h for the current decomposition
+
+	void evolve(double duration, int heating, int record);
+	void derivs(double *T, double *dTdt);
+	void jacobian(double *T, double *f);
+	void factor(double gh);
+	void solve(double *r, double *x);
+	void save(double t);
+};
+
+// 'crustcool --ensemble <file>': each line of the file gives one model's values
+// of Qimp, Qinner, Tc, Tt and mdot (e.g. "Qimp 2.0 Tc 3e7"), and
+// "<line number> <chisq>" is written to stdout for each model
+void run_ensemble(Run &base, const char *fname);
+
+#endif
@@ -9,6 +9,7 @@ public:
 	~Envelope();
 	
 	double g;    // gravity in cgs units
+	double ybase;   // log10 column depth at the base of the ocean integration
 	
 	int use_potek_eos_in_He;
 	int use_potek_eos_in_Fe;
@@ -21,13 +22,19 @@ public:
 	// set B=0 for unmagnetized envelope	
 	void make_grid(double yi, double B);
 
+	// calculates a single envelope model with flux F and returns log10 T 
+	// at the ny column depths lgy (NAN above the photosphere); returns 0 (with
+	// lgT all NAN) if the photosphere lies beneath the light element layer
+	int solve(double yi, double B, double F, int ny, double *lgy, double *lgT);
+
 private:
-	static double Wrapper_find_surf_eqn(double r);
+	static double Wrapper_find_surf_eqn(double r, void *p);
 	double find_surf_eqn(double r);
 	Eos *EOS;
 	Ode_Int ODE, ODE2;
-	void doint(void);
+	int doint(int nout, double *xout);
 	void calculate(void);
+	int interpolate_profile(Ode_Int *ode, double x, double *lgT);
 	FILE *fp;
 	double Bfield;
 	double yi;
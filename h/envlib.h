@@ -0,0 +1,35 @@
+// An indexed library of envelope models made by 'makegrid' in batch mode.
+// Each model is the temperature profile log10 T(log10 y) for one
+// (yi, B, g, flux) combination, all sampled on the same column depth grid.
+
+#include <stddef.h>
+
+class EnvelopeLibrary {
+public:
+	EnvelopeLibrary();
+	~EnvelopeLibrary();
+
+	// axes of the library
+	int nyi, nB, ng, nF, ny;
+	double *yi;    // log10 base column of the light element layer (0 means iron)
+	double *B;     // magnetic field in G
+	double *g;     // gravity in cgs
+	double *lgF;   // log10 flux
+	double *lgy;   // log10 column depth at which the profile is stored
+	double *lgT;   // log10 temperature, nyi*nB*ng*nF*ny values
+
+	void allocate(int nyi, int nB, int ng, int nF, int ny, double *data);
+	size_t index(int iyi, int iB, int ig, int iF);
+	double *profile(int iyi, int iB, int ig, int iF);
+	size_t size(void);
+	int read(const char *fname);
+	void write(const char *fname);
+
+	// log10 T at column depth lgy0 for each of the nF fluxes, interpolated
+	// to (yi, B, g); returns 0 if the point lies outside the library
+	int relation(double yi, double B, double g, double lgy0, double *lgTb);
+
+private:
+	int owns_data;
+	int bracket(double *axis, int n, double x, int log_axis, int *i, double *w);
+};
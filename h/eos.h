@@ -1,3 +1,6 @@
+#ifndef EOS_H
+#define EOS_H
+
 class Eos {
 public:
 	Eos(int n);
@@ -11,7 +14,7 @@ public:
 
 	// find density from pressure
 	double find_rho(void);
-	static double Wrapper_find_rho_eqn(double r);
+	static double Wrapper_find_rho_eqn(double r, void *p);
 	double find_rho_eqn(double r);
 
 	// mean molecular weights
@@ -72,3 +75,5 @@ private:
 	double expint(int n, double x);	
 
 };
+
+#endif
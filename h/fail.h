@@ -0,0 +1,17 @@
+// Fatal errors in a model, such as an init file that can't be read or
+// parameters that can't be used. fail() prints the message and exits, as the
+// programs always have, unless the calling thread has asked for the error to be
+// thrown as a Failure instead (the library does this, see libcrustcool.cc, so
+// that a bad model doesn't end the program that is using it).
+
+#ifndef FAIL_H
+#define FAIL_H
+
+struct Failure {
+	char message[256];
+};
+
+void fail(const char *format, ...);
+void fail_by_throwing(int on);    // for the calling thread
+
+#endif
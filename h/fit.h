@@ -0,0 +1,51 @@
+// Levenberg-Marquardt fit of the parameters that have a prior in init.dat, to
+// the residuals (data-model)/error of the data points. The models run on the
+// sampler's pool of warm Runs, and the fit stays inside the priors, in the same
+// coordinates as the samplers (log10 of the parameter for a log prior). The
+// covariance is the inverse of the Fisher matrix J^T J, which also gives the
+// Laplace approximation to the evidence.
+
+#ifndef FIT_H
+#define FIT_H
+
+#include <stdio.h>
+#include <vector>
+#include "sampler.h"
+
+class Fitter {
+public:
+	Fitter(Run &base, int nthreads);
+
+	int ndim, ndata;
+	int maxiter;          // iterations (default 100)
+	double tol;           // stop when an iteration lowers chisq by less than this (default 1e-3)
+	double fd_step;       // step for the Jacobian in units of the prior widths (default 1e-3)
+	double lambda;        // the damping
+	std::vector<double> x, r;     // the current point and its residuals
+	double chisq;
+	double logZ;                  // Laplace approximation to the evidence
+	std::vector<double> J;        // Jacobian of the residuals, J[j*ndim+d]
+	std::vector<double> cov;      // covariance of the coordinates, cov[d*ndim+e]
+	int iter, ncalls;
+
+	void start(void);
+	int fit(void);
+	void jacobian(int central=0);
+	int covariance(void);
+	void write(FILE *fp);
+
+	Sampler sampler;
+
+private:
+	int trial(const double *lambdas, int n);
+};
+
+// 'crustcool --fit <file> [-j nthreads] [name]': fits the parameters starting
+// from their values in init.dat, and writes the best fit and its covariance to <file>
+void run_fit(Run &base, const char *fname, int nthreads);
+
+// 'crustcool --fisher <file> [-j nthreads] [name]': the Fisher matrix covariance
+// at the parameters in init.dat (e.g. a best fit), written to <file> in the same form
+void run_fisher(Run &base, const char *fname, int nthreads);
+
+#endif
@@ -0,0 +1,41 @@
+// A cache of the temperature profile at the end of the outburst, keyed by a
+// hash of everything that the outburst depends on (see Run::heating_key).
+// Fits often repeat the heating parameters while the cooling or the data
+// parameters change, and a hit lets the cooling start without the outburst.
+// One cache is shared by all the runs in a process; the least recently used
+// profiles are dropped when it is full. Optionally the profiles are also kept
+// in files in out/heatcache, so that later processes can use them.
+
+#ifndef HEATCACHE_H
+#define HEATCACHE_H
+
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+
+class HeatingCache {
+public:
+	HeatingCache();
+	int get(unsigned long long key, std::vector<double> &T, int nmax, int disk);
+	void put(unsigned long long key, const std::vector<double> &T, int nmax, int disk);
+	int hits, misses;
+
+private:
+	struct Entry {
+		unsigned long long key;
+		std::vector<double> T;
+	};
+	std::list<Entry> entries;    // most recently used first
+	std::unordered_map<unsigned long long, std::list<Entry>::iterator> index;
+	std::mutex lock;
+
+	void insert(unsigned long long key, const std::vector<double> &T, int nmax);
+	void filename(unsigned long long key, char *s);
+	int read_file(unsigned long long key, std::vector<double> &T);
+	void write_file(unsigned long long key, const std::vector<double> &T);
+};
+
+HeatingCache &heating_cache(void);
+
+#endif
@@ -0,0 +1,74 @@
+// C interface to crustcool, for calling it from other programs and languages
+// (the Python module in pycrustcool.cc is built on it).
+//
+// A model is configured from an init.dat file and/or individual parameters,
+// and can then be evolved as many times as needed:
+//
+//     crustcool *cc = crustcool_new();
+//     crustcool_read(cc,"init.dat");
+//     crustcool_set(cc,"Tc",3e7);
+//     double chisq = crustcool_evolve(cc);
+//
+// The setup (grid, envelope and precalculated tables) is done on the first
+// evolve, and again only if a parameter that it depends on is changed.
+// Separate models can be evolved at the same time on different threads.
+//
+// The lightcurve and profile functions return pointers into the model's own
+// buffers, which are overwritten (and may be reallocated) by the next evolve
+// or setup, so copy what you need before calling either. Or pin the model
+// while the pointers are held: buffers that are replaced are then kept
+// until the matching unpin, so the pointers stay valid (they just no longer
+// follow the model).
+//
+// An error in a model (e.g. a file that can't be read or parameters that can't
+// be used) doesn't end the program: the function that hit it returns 0 (or NAN
+// for crustcool_evolve), and crustcool_error gives the message. The model is set
+// up again on the next evolve.
+
+#ifndef LIBCRUSTCOOL_H
+#define LIBCRUSTCOOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct crustcool crustcool;
+
+crustcool *crustcool_new(void);
+void crustcool_free(crustcool *cc);
+
+// parameters use the names in init.dat; these return 0 if the file can't be
+// read or the parameter name is not recognized
+int crustcool_read(crustcool *cc, const char *fname);
+int crustcool_set(crustcool *cc, const char *key, double value);
+int crustcool_set_string(crustcool *cc, const char *key, const char *value);
+
+int crustcool_setup(crustcool *cc);      // returns 0 on error
+double crustcool_evolve(crustcool *cc);    // returns chi-squared, or NAN on error
+double crustcool_chisq(crustcool *cc);     // chi-squared from the last evolve
+const char *crustcool_error(crustcool *cc);   // message for the last error ("" if none)
+
+// evolves n models that differ from cc only in Qimp, Qinner, Tc, Tt and mdot
+// together (see ensemble.cc), and puts their chi-squared values in chisq.
+// Any of the parameter arrays can be NULL to use the value in cc for every model.
+// Returns 0 on error.
+int crustcool_evolve_ensemble(crustcool *cc, int n, const double *Qimp, const double *Qinner,
+	const double *Tc, const double *Tt, const double *mdot, double *chisq);
+
+// model lightcurve from the last evolve: observer time in days and Teff in eV
+// (or luminosity in erg/s); returns the number of points
+int crustcool_lightcurve(crustcool *cc, const double **t, const double **y);
+
+// pressure, density and temperature on the grid at the end of the last evolve;
+// returns the number of points. The values are stride doubles apart.
+int crustcool_profile(crustcool *cc, const double **P, const double **rho, const double **T, int *stride);
+
+// pins can be nested; the model must not be freed while it is pinned
+void crustcool_pin(crustcool *cc);
+void crustcool_unpin(crustcool *cc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
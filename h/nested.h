@@ -0,0 +1,48 @@
+// Nested sampling (Skilling 2006, Bayesian Analysis 1, 833) for the Bayesian
+// evidence of a model, with the parameters and flat priors given by the "prior"
+// lines in init.dat as for the MCMC sampler. The models are run on the sampler's
+// thread pool, replacing a batch of the lowest likelihood live points at a time.
+
+#ifndef NESTED_H
+#define NESTED_H
+
+#include <vector>
+#include <gsl/gsl_rng.h>
+#include "sampler.h"
+
+class NestedSampler {
+public:
+	NestedSampler(Run &base, int nthreads);
+	~NestedSampler();
+
+	int nlive;          // number of live points (default 400)
+	int nbatch;         // live points replaced at a time (default the number of threads)
+	int nwalk;          // steps of the random walk for each new point (default 20)
+	double dlogz;       // stop when the live points could add less than this to log Z (default 0.1)
+	unsigned long seed;
+
+	double logZ, logZerr, H;    // evidence, its error and the information (nats)
+	int ncalls;
+
+	void run(void);
+	void write_samples(const char *fname);
+
+private:
+	Sampler sampler;
+	int ndim;
+	gsl_rng *rng;
+	std::vector<double> u, lnL;           // live points in the unit cube, and their log likelihoods
+	std::vector<double> dead_u, dead_lnL, dead_logw;
+	double scale;                         // size of the random walk steps
+
+	void to_coordinates(int n, const double *u, double *x);
+	void evaluate(int n, const double *u, double *lnL);
+	void replace(const std::vector<int> &worst, double lnLmin);
+	void add_dead(int k, double logw);
+};
+
+// 'crustcool --nested <samples> [-j nthreads] [-l nlive] [-m nwalk] [-s seed]':
+// prints the evidence, and writes the weighted posterior samples to <samples>
+void run_nested(Run &base, const char *fname, int nthreads, int nlive, int nwalk, unsigned long seed);
+
+#endif
@@ -1,3 +1,6 @@
+#ifndef ODEINT_H
+#define ODEINT_H
+
 #include <gsl/gsl_odeiv2.h>
 
 class Ode_Int_Delegate {
@@ -9,6 +12,7 @@ public:
 
 class Ode_Int {
 public:
+	Ode_Int();
 	int ignore, kount, stiff, verbose, tri, use_gsl;
 	double dxsav, minstep, hmax;
 	void init(int n,Ode_Int_Delegate *delegate);
@@ -16,6 +20,7 @@ public:
 	void go(double x1, double x2, double xstep, double eps);
 	void go_gsl(double x1, double x2, int nstep, double eps, int log_flag);
 	void go_simple(double x1, double x2, int nstep);	
+	void go_scalar(double x1, double x2, double eps, int nout, double *xout);
 	void set_bc(int n, double num);
 	double get_x(int i);
 	double get_y(int n, int i);
@@ -34,8 +39,10 @@ private:
 	gsl_odeiv2_evolve *evolve;
 	gsl_odeiv2_driver *driver; 
 
+	double rkck_scalar(double x, double y, double dydx, double h, double *yerr);
 	double **dydxp,*hstr,*ystart;
-	int kmax,nvar;
+	int kmax,maxsteps,nvar;
+	void reserve(int n);
 	void rkck(double y[], double dydx[], int n, double x, double h,
 	   double yout[],
 	   double yerr[]);
@@ -68,3 +75,5 @@ private:
 	void banbks(double **a, unsigned long n, int m1, int m2, double **al,
 	     int *indx, double b[]);
 };
+
+#endif
@@ -0,0 +1,42 @@
+// A pool of worker threads with work stealing.
+// Each worker has its own queue of tasks; it takes from the back of its own queue
+// and, when that is empty, steals from the front of the others. Tasks are given
+// the index of the worker running them, so that they can use per-worker state
+// (e.g. a Run that has already been set up).
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+typedef std::function<void(int)> Task;
+
+class ThreadPool {
+public:
+	ThreadPool(int nthreads);
+	~ThreadPool();
+	int nthreads;
+	void submit(Task task);
+	void wait(void);      // waits until every submitted task has finished
+
+private:
+	struct Queue {
+		std::deque<Task> tasks;
+		std::mutex lock;
+	};
+	std::vector<Queue *> queues;
+	std::vector<std::thread> threads;
+	std::mutex lock;
+	std::condition_variable wake, idle;
+	int queued, pending, next, stopping;
+
+	int take(int w, Task &task);
+	void work(int w);
+};
+
+#endif
@@ -0,0 +1,62 @@
+// Reduced-order model of the crust's time evolution. The profile ln T is
+// expanded in a few proper orthogonal decomposition (POD) modes found from the
+// profiles of full runs, and the equations are projected onto them, with d ln T/dt
+// needed only at a few cells chosen by the discrete empirical interpolation
+// method (DEIM). It works with the grid, tables and envelope of the Run it
+// belongs to (which must have the same grid and crust settings as the training
+// runs; load checks this), and replaces the outburst and the cooling when
+// init.dat has a line "rom <file>".
+
+#ifndef ROM_H
+#define ROM_H
+
+#include <vector>
+#include "odeint.h"
+
+class Run;
+class Crust;
+
+class ReducedModel: public Ode_Int_Delegate {
+public:
+	ReducedModel(Run &run);
+	virtual ~ReducedModel();
+
+	int n, r, m;                   // cells (N+1), POD modes and DEIM cells
+	std::vector<double> mean;      // the mean of ln T over the training profiles, mean[i-1] for cell i
+	std::vector<double> phi;       // the modes, phi[(i-1)*r+k]
+	std::vector<int> cells;        // the DEIM cells
+	std::vector<double> B;         // maps d ln T/dt at the DEIM cells to da/dt, B[k*m+l]
+
+	// the top temperature after each step of the last run, at times tsave
+	// (seconds, star frame, from the start of the last phase), both from 1
+	std::vector<double> tsave, Tsave;
+	int nsave;
+
+	int load(const char *fname);
+	void save(const char *fname);
+	void build(std::vector<double> &z, std::vector<double> &g, int rank, double tol);
+	void run(void);
+
+	void derivs(double t, double a[], double dadt[]);
+	void jacobn(double t, double *a, double *dadt, double **dfda, int n);
+
+	// the profile ln T and d ln T/dt after every step of the crust's last evolve
+	static void snapshots(Crust &crust, std::vector<double> &z, std::vector<double> &g);
+
+private:
+	Run &owner;
+	Ode_Int ODE;
+	std::vector<int> stencil;      // the cells that the DEIM cells' derivatives depend on
+	std::vector<double> T, a, g, f1;   // work space for derivs and jacobn
+	void prepare(void);
+	void expand(const double *a, int all);
+	void evolve(double timetorun, double mdot, std::vector<double> &a, int record);
+};
+
+// 'crustcool --rom <file> [-j nthreads] [-n ntrain] [-r rank] [-s seed] [name]':
+// runs ntrain full models at a Latin hypercube over the priors (or just the model
+// in init.dat if there are none), builds a reduced model from their profiles,
+// and writes it to <file>
+void run_rom(Run &base, const char *fname, int nthreads, int ntrain, int rank, unsigned long seed);
+
+#endif
@@ -1 +1 @@
-double zbrent(double (*func)(double), double x1, double x2, double tol);
+double zbrent(double (*func)(double, void *), void *params, double x1, double x2, double tol);
@@ -0,0 +1,118 @@
+// A complete model run: the crust, its parameters, and the data it is compared with.
+// This is what the crustcool executable does, packaged so that a model can be
+// set up once and then run many times with different parameters (see libcrustcool.h)
+
+#ifndef RUN_H
+#define RUN_H
+
+#include <vector>
+#include "crust.h"
+#include "data.h"
+
+class ReducedModel;
+
+// The stages of a run. Each parameter lists the first stage that depends on it,
+// and changing it means that stage and everything after it is done again.
+// The grid, tables and envelope are all made by Crust::setup, so any of them
+// being out of date means a new setup.
+enum {
+	STAGE_GRID=1,
+	STAGE_TABLES=2,
+	STAGE_ENVELOPE=4,
+	STAGE_HEATING=8,     // the outburst, up to the start of cooling
+	STAGE_COOLING=16,
+	STAGE_DATA=32,       // the observations (only the source name)
+	STAGE_CHISQ=64
+};
+#define STAGE_SETUP (STAGE_GRID|STAGE_TABLES|STAGE_ENVELOPE)
+
+struct Parameter {
+	const char *name;   // name in init.dat
+	double *d;          // points to the value (one of d or i is set)
+	int *i;
+	int stage;          // first stage that depends on this parameter (0 for none)
+};
+
+// a flat prior on a parameter for the samplers, from a line "prior <name> <min> <max> [log]"
+// in init.dat; with log the prior is flat in log10 of the parameter between min and max
+struct Prior {
+	char name[64];
+	double min, max;
+	int log;
+};
+
+// n points of a Latin hypercube over the priors, as unit cube coordinates u and
+// sampler coordinates x (u[k*ndim+d], x[k*ndim+d])
+void latin_hypercube(int n, std::vector<Prior> &priors, unsigned long seed, double *u, double *x);
+
+// a parameter value for the cheap screening model of the samplers, from a line
+// "cheap <name> <value>" in init.dat (e.g. "cheap ngrid 20")
+struct Override {
+	char name[64];
+	double value;
+};
+
+class Run {
+public:
+	Run();
+	~Run();
+
+	Crust crust;
+	Data data;
+
+	char sourcename[200];
+	double time_to_run;
+	int use_piecewise, output_heating, output_cooling;
+	int cache_outburst, cache_disk;   // profiles kept in the heating cache, and whether it uses files
+	char emulator[200];   // emulator file for the samplers ("" for none)
+	double emu_tol;       // the samplers use the emulator where its chisq error is below this
+	char rom_file[200];   // reduced model that replaces the outburst and cooling ("" for none)
+	ReducedModel *rom;    // loaded from rom_file by the first run that needs it
+	double chisq;     // result of the last run
+	std::vector<Prior> priors;
+	std::vector<Override> cheap;
+	int needs_setup;  // set when a parameter that setup depends on differs from the last setup
+	int dirty;        // stages to be done again by the next run
+
+	int read_parameters(const char *fname);
+	int set_parameter(const char *key, double x);
+	double get_parameter(const char *key);
+	int set_string_parameter(const char *key, const char *value);
+	void copy_parameters(Run &from);
+	int same_setup(Run &other);
+	void set_piecewise_profile(double *rho, double *T, int n);
+	void setup(void);
+	void setup_from(Run &base);
+	void invalidate(int stages);
+	double run(void);
+
+private:
+	Parameter params[64];
+	int nparams;
+	void add_parameter(const char *name, double *d, int stage);
+	void add_parameter(const char *name, int *i, int stage);
+	double get(Parameter *p);
+	unsigned long long heating_key(void);
+
+	// the parameters of the last run (or setup), which dirty is worked out from,
+	// and the stages invalidated since then whatever the parameters
+	double last[64];
+	char last_source[200], last_envlib[200], last_rom[200];
+	double last_rhovec[102], last_Tvec[102];
+	int last_nvec;
+	int forced;
+	void update_dirty(void);
+	void mark_done(void);
+
+	std::vector<double> heated_T;   // the temperature profile at the end of the outburst
+	double heated_time, heated_last_output;
+
+	double rhovec[102], Tvec[102];   // initial temperature profile for piecewise
+	int nvec;
+	void parse_file(const char *fname);
+	void read_prior(const char *line);
+	void read_cheap(const char *line);
+	void read_piecewise_profile(const char *fname);
+};
+
+#endif
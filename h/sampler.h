@@ -0,0 +1,80 @@
+// Affine-invariant ensemble sampler for the parameters that have a prior in
+// init.dat ("prior <name> <min> <max> [log]"). The walkers use the stretch move
+// of Goodman & Weare (2010, CAMCoS 5, 65), the same as emcee, and the models are
+// run on a thread pool of warm Runs that share the base model's grid and tables.
+// The coordinates are the parameters, or log10 of them for a log prior, and the
+// log posterior is -chisq/2 inside the priors. With ntemps > 1 it runs parallel
+// tempering, with an ensemble of walkers at each temperature. If init.dat has
+// "cheap <name> <value>" lines, the proposals are first screened with a cheap
+// version of the model with those parameters (delayed acceptance). With an
+// "emulator <file>" line, models are only run where the emulator (see
+// emulator.h) is unsure of chi-squared.
+
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stdio.h>
+#include <vector>
+#include <gsl/gsl_rng.h>
+#include "run.h"
+#include "pool.h"
+#include "emulator.h"
+
+class Sampler {
+public:
+	Sampler(Run &base, int nthreads);
+	~Sampler();
+
+	int ndim, nwalkers;            // nwalkers at each temperature
+	int ntemps;                    // number of temperatures (default 1, no tempering)
+	double tmax;                   // the hottest temperature (default 100)
+	double a;                      // scale of the stretch move (default 2)
+	unsigned long seed;
+	std::vector<double> beta;      // 1/temperature, beta[0]=1
+	// walker k at temperature t is n=t*nwalkers+k, at x[n*ndim+d] with log posterior lnp[n]
+	std::vector<double> x, lnp;
+	int step, naccepted;           // steps taken, and beta=1 proposals accepted in the last step
+	int nswapped;                  // swaps between temperatures accepted in the last step
+	int npassed;                   // beta=1 proposals that passed the cheap model in the last step
+	std::vector<double> lnc;       // log posterior of each walker with the cheap model
+
+	Emulator *emulator;            // or NULL
+	double emu_tol;                // largest uncertainty in chisq for which the emulator is used
+	long nemulated, nmodels;       // evaluations done by the emulator and by the model
+
+	void start(void);
+	void advance(void);
+	int resume(const char *fname);
+	void checkpoint(const char *fname);
+
+	void evaluate(int n, const double *x, double *lnp, int cheap=0, double *resid=NULL);
+	double lnprior(const double *x);
+	double value(int d, double xd);
+	double coordinate(int d, double value);
+
+	Run &base;
+	std::vector<Prior> &priors;
+
+private:
+	ThreadPool pool;
+	std::vector<Run *> workers, cheap_workers;
+	Run *cheap_base;      // the cheap model, or NULL
+	gsl_rng *rng;
+	double lnprob(Run *run, Run &from, const double *x);
+	void seed_step(int k);
+	void set_ladder(void);
+	void swap(void);
+};
+
+struct SamplerOptions {
+	int nwalkers, nsteps, ntemps;    // 0 for the defaults
+	unsigned long seed;
+	double tmax;                     // 0 for the default
+};
+
+// 'crustcool --sample <chain> [options]': samples the posterior, appending each step
+// to the binary file <chain>, and carries on from the last step in <chain> if it
+// already exists
+void run_sampler(Run &base, const char *chain, int nthreads, SamplerOptions &opt);
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+#include "run.h"
+
+void serve(Run &run, const char *path);
+
+#endif
@@ -1,3 +1,6 @@
+#ifndef SPLINE_H
+#define SPLINE_H
+
 #include <gsl/gsl_spline.h>
 
 class Spline {
@@ -19,3 +22,5 @@ private:
   double *xtab;
   int num;
 };
+
+#endif
@@ -2,3 +2,4 @@
 
 void start_timing(clock_t *timer);
 void stop_timing(clock_t *timer, const char*string);
+double wall_time(void);
@@ -2,3 +2,7 @@ double *vector(long n);
 double **matrix(long nx, long ny);
 void free_vector(double *v);
 void free_matrix(double **m, long nx, long ny);
+// Cholesky factor of a symmetric n x n matrix a[i*n+j] in place (returns 0 if it isn't
+// positive definite), and the solution of L L^T x = b with the factor
+int cholesky(int n, double *a);
+void cholesky_solve(int n, const double *L, const double *b, double *x);
@@ -17,6 +17,13 @@ import ns
 import random
 from multiprocessing import Pool
 
+# use the crustcool Python module if it has been built ('make python'),
+# otherwise run the crustcool executable for each model
+try:
+	import crustcool
+except ImportError:
+	crustcool = None
+
 os.environ["OMP_NUM_THREADS"] = "1"
 def main():
 
@@ -91,7 +98,7 @@ def main():
 	#imessage.send('mcee '+dir+' has finished running')
 
 
-def set_params(x,name):
+def base_params():
 	data="""resume 0
 
 mass	1.62
@@ -120,6 +127,10 @@ Tt	4.2e8
 #extra_Q	1.4
 #extra_y	1e13
 """
+	return data
+
+
+def trial_params(x):
 	# Q,Lscale,Edep,Tc,M,R	
 	#radius = ns.R(x[4],x[5])
 	#Lmin = PYL(x[3]*1e7, 1e14, x[4], radius)
@@ -137,7 +148,12 @@ Tt	4.2e8
 #		'extra_Q':x[0],
 #		'extra_y':x[1]
 	}
+	return params
+
 
+def set_params(x,name):
+	data = base_params()
+	params = trial_params(x)
 	for key,value in list(params.items()):
 		data = re.sub("%s(\\t?\\w?).*\\n" % key,"%s\\t%g\\n" % (key,value),data)
 
@@ -154,7 +170,29 @@ Tt	4.2e8
 	fout.close()
 
 
+# each worker process keeps one model, so that it is only set up once
+model = None
+
+def get_chisq_module(x):
+	global model
+	if model is None:
+		model = crustcool.Model()
+		for line in base_params().splitlines():
+			words = line.split()
+			if len(words) >= 2 and not line.startswith('#'):
+				try:
+					model.set(**{words[0]: float(words[1])})
+				except ValueError:
+					model.set(**{words[0]: words[1]})
+		model.set(output_cooling=0)   # the lightcurve comes back through the module
+		model.set(shared_tables=1)    # the Pool workers map one copy of the tables
+	model.set(**trial_params(x))
+	return model.evolve()
+
+
 def get_chisq(x):
+	if crustcool is not None:
+		return get_chisq_module(x)
 	name = str(uuid.uuid4())
 	set_params(x,name)
 	# give crustcool a second parameter so that it looks in /tmp for the init.dat file